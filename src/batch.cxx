@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#endif
+
+#include "batch.h"
+
+// look batch.h for function definitions
+
+#define MAX_JOB_ARGS 256
+
+// a job: the command line of one compile
+typedef struct
+{
+    int argc;
+    char **argv;
+    int line;
+    long long weight;   // size of the input file
+    double seconds;
+    int failed;
+} BatchJob;
+
+// adds a job with the options of the batch before the words of the
+// manifest line. The job has copies of them.
+static void addJob(BatchJob **jobList, int *count, char **options, int nroOptions,
+                   char **words, int nroWords, int line)
+{
+    *jobList = (BatchJob *) realloc(*jobList, (*count + 1) * sizeof(BatchJob));
+    BatchJob *job = &(*jobList)[(*count)++];
+    job->argv = (char **) malloc((3 + nroOptions + nroWords + 1) * sizeof(char *));
+    job->argc = 0;
+    job->argv[job->argc++] = (char *) "pooleditparser";
+    job->argv[job->argc++] = strdup(words[0]);
+    job->argv[job->argc++] = strdup(words[1]);
+    for (int i = 0; i < nroOptions; i++)
+        job->argv[job->argc++] = strdup(options[i]);
+    for (int i = 2; i < nroWords; i++)
+        job->argv[job->argc++] = strdup(words[i]);
+    job->argv[job->argc] = NULL;
+    job->line = line;
+    job->seconds = 0;
+    job->failed = false;
+
+#ifndef _WIN32
+    struct stat info;
+    job->weight = stat(words[0], &info) == 0 ? info.st_size : 0;
+#else
+    job->weight = 0;
+#endif
+}
+
+static void freeJobs(BatchJob *jobList, int count)
+{
+    for (int i = 0; i < count; i++) {
+        for (int j = 1; j < jobList[i].argc; j++)
+            free(jobList[i].argv[j]);
+        free(jobList[i].argv);
+    }
+    free(jobList);
+}
+
+// reads the jobs of the manifest, returns NULL on error
+static BatchJob *readManifest(const char *fileName, char **options, int nroOptions, int *count)
+{
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL) {
+        printf("Can't open file: %s\n", fileName);
+        return NULL;
+    }
+    BatchJob *jobList = NULL;
+    *count = 0;
+    char line[4096];
+    int lineNumber = 0;
+    int ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char *words[MAX_JOB_ARGS];
+        int nroWords = 0;
+        int nroProfileOptions = 0;
+        for (char *word = strtok(line, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+            if (nroWords == 0 && word[0] == '#')
+                break;
+            if (nroWords == MAX_JOB_ARGS) {
+                printf("Too many options in %s line %d\n", fileName, lineNumber);
+                ok = false;
+                break;
+            }
+            if (strncmp("-profile=", word, 9) == 0)
+                nroProfileOptions++;
+            words[nroWords++] = word;
+        }
+        if (!ok || nroWords == 0)
+            continue;
+        if (nroWords < 2) {
+            printf("Invalid job in %s line %d\n", fileName, lineNumber);
+            ok = false;
+            continue;
+        }
+
+        if (nroProfileOptions < 2)
+            addJob(&jobList, count, options, nroOptions, words, nroWords, lineNumber);
+        else {
+            // every job leaves out the other profiles
+            for (int i = 2; i < nroWords; i++) {
+                if (strncmp("-profile=", words[i], 9) != 0)
+                    continue;
+                char *profileWords[MAX_JOB_ARGS];
+                int nroProfileWords = 0;
+                for (int j = 0; j < nroWords; j++)
+                    if (j == i || strncmp("-profile=", words[j], 9) != 0)
+                        profileWords[nroProfileWords++] = words[j];
+                addJob(&jobList, count, options, nroOptions, profileWords, nroProfileWords,
+                       lineNumber);
+            }
+        }
+    }
+    fclose(file);
+    if (!ok || *count == 0) {
+        if (ok)
+            printf("No jobs in %s\n", fileName);
+        freeJobs(jobList, *count);
+        return NULL;
+    }
+    return jobList;
+}
+
+#ifndef _WIN32
+// seconds from some fixed time, for measuring the wall time of jobs
+static double wallTime()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static BatchJob *sortedJobs;
+
+// orders the jobs by input size, largest first, so that the long jobs
+// don't start last and keep one process busy alone at the end
+static int compareJobs(const void *a, const void *b)
+{
+    const BatchJob *jobA = &sortedJobs[*(const int *) a];
+    const BatchJob *jobB = &sortedJobs[*(const int *) b];
+    if (jobA->weight != jobB->weight)
+        return jobA->weight < jobB->weight ? 1 : -1;
+    return *(const int *) a - *(const int *) b;
+}
+#endif
+
+int runBatch(int argc, char *argv[], int (*compile)(int argc, char *argv[]))
+{
+#ifdef _WIN32
+    (void) argc;
+    (void) argv;
+    (void) compile;
+    printf("ERROR: -batch is not supported on this platform\n");
+    return -1;
+#else
+    const char *manifest = argv[1] + 7;
+    int workers = 0;
+    char **options = (char **) malloc(argc * sizeof(char *));
+    int nroOptions = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp("-jobs=", argv[i], 6) == 0)
+            workers = atoi(argv[i] + 6);
+        else
+            options[nroOptions++] = argv[i];
+    }
+
+    int count;
+    BatchJob *jobList = readManifest(manifest, options, nroOptions, &count);
+    free(options);
+    if (jobList == NULL)
+        return -1;
+
+    int *order = (int *) malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++)
+        order[i] = i;
+    sortedJobs = jobList;
+    qsort(order, count, sizeof(int), compareJobs);
+
+    if (workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > count)
+        workers = count;
+    if (workers < 1)
+        workers = 1;
+
+    // a process is started for every job when one of the previous ones
+    // has finished. The output of a job is kept in a temporary file and
+    // printed when the job has finished.
+    pid_t *pids = (pid_t *) calloc(workers, sizeof(pid_t));
+    int *running = (int *) malloc(workers * sizeof(int));
+    FILE **logs = (FILE **) malloc(workers * sizeof(FILE *));
+    double *started = (double *) malloc(workers * sizeof(double));
+    double start = wallTime();
+    int next = 0;
+    int active = 0;
+    int finished = 0;
+    int failed = 0;
+    while (next < count || active > 0) {
+        for (int slot = 0; slot < workers && next < count; slot++) {
+            if (pids[slot] != 0)
+                continue;
+            BatchJob *job = &jobList[order[next++]];
+            logs[slot] = tmpfile();
+            if (logs[slot] == NULL) {
+                printf("Can't create temporary file: %s\n", strerror(errno));
+                exit(-4);
+            }
+            fflush(stdout);
+            started[slot] = wallTime();
+            pid_t pid = fork();
+            if (pid < 0) {
+                printf("Can't start process: %s\n", strerror(errno));
+                exit(-4);
+            }
+            if (pid == 0) {
+                dup2(fileno(logs[slot]), 1);
+                setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+                exit(compile(job->argc, job->argv));
+            }
+            pids[slot] = pid;
+            running[slot] = job - jobList;
+            active++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            printf("ERROR: can't wait for jobs: %s\n", strerror(errno));
+            exit(-4);
+        }
+        int slot = 0;
+        while (slot < workers && pids[slot] != pid)
+            slot++;
+        if (slot == workers)
+            continue;
+
+        BatchJob *job = &jobList[running[slot]];
+        job->seconds = wallTime() - started[slot];
+        job->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        failed += job->failed;
+        pids[slot] = 0;
+        active--;
+        finished++;
+
+        char buffer[64 * 1024];
+        size_t length;
+        rewind(logs[slot]);
+        while ((length = fread(buffer, 1, sizeof(buffer), logs[slot])) > 0)
+            fwrite(buffer, 1, length, stdout);
+        fclose(logs[slot]);
+        if (job->failed)
+            printf("ERROR: job of %s line %d failed: %s -> %s\n",
+                   manifest, job->line, job->argv[1], job->argv[2]);
+        printf("* job %d/%d (line %d): %s -> %s: %.3f s\n",
+               finished, count, job->line,
+               job->argv[1], job->argv[2], job->seconds);
+    }
+
+    double seconds = wallTime() - start;
+    double jobSeconds = 0;
+    for (int i = 0; i < count; i++)
+        jobSeconds += jobList[i].seconds;
+    printf("***************************************************\n"
+           "* batch: %d jobs, %d failed\n"
+           "* processes: %d\n"
+           "* wall time: %.3f s\n"
+           "* job time: %.3f s (%.1fx)\n"
+           "***************************************************\n",
+           count, failed, workers, seconds, jobSeconds,
+           jobSeconds / (seconds > 0 ? seconds : 1));
+
+    free(started);
+    free(logs);
+    free(running);
+    free(pids);
+    free(order);
+    freeJobs(jobList, count);
+    return failed > 0 ? -4 : 0;
+#endif
+}
+
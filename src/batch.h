@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+// Batch compile. The manifest has one job per line, "input output
+// [options]" separated by spaces, and lines starting with '#' are
+// comments. The options of the command line are used with every job
+// before the options of its line, so that the line can override them.
+// A line with several -profile options is split to a job for every
+// profile, because those compile in parallel.
+//
+// The jobs run in parallel processes, the largest inputs first. The
+// output of a job is printed when it has finished, and the batch fails
+// if any of the jobs fails.
+
+// runs the jobs of the manifest named by the first option (-batch=),
+// -jobs= sets the number of processes. compile() is called in the
+// process of a job like main(). Returns 0 if all the jobs succeeded.
+int runBatch(int argc, char *argv[], int (*compile)(int argc, char *argv[]));
+
+#endif
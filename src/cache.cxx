@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+#include "cache.h"
+
+// look cache.h for function definitions
+
+#define CACHE_MAGIC 0x43504550  // "PEPC"
+#define CACHE_VERSION 1
+
+typedef struct
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long key;
+    int length;
+} CacheHeader;
+
+unsigned long long hashBytes(const void *data, int length, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    unsigned long long hash = seed;
+    for (int i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+unsigned long long hashInt(int value, unsigned long long seed)
+{
+    return hashBytes(&value, sizeof(value), seed);
+}
+
+// an entry kept in memory, data has the header like the file
+typedef struct
+{
+    char *dir;
+    char ext[8];
+    unsigned long long key;
+    char *data;
+    int length;
+    long long used;
+} KeptEntry;
+
+KeptEntry *keptEntries = NULL;
+int nroKeptEntries = 0;
+long long keptBytes = 0;
+long long keptClock = 0;
+
+void (*usedFunct)(const char *dir, const char *ext, unsigned long long key) = NULL;
+
+// returns the kept entry, or NULL if it isn't kept
+static KeptEntry *findKept(const char *dir, const char *ext, unsigned long long key)
+{
+    for (int i = 0; i < nroKeptEntries; i++) {
+        KeptEntry *kept = &keptEntries[i];
+        if (kept->key == key && strcmp(kept->ext, ext) == 0 && strcmp(kept->dir, dir) == 0) {
+            kept->used = ++keptClock;
+            return kept;
+        }
+    }
+    return NULL;
+}
+
+static void reportUsed(const char *dir, const char *ext, unsigned long long key)
+{
+    if (usedFunct != NULL)
+        usedFunct(dir, ext, key);
+}
+
+// builds the file name of a cache entry
+static void cachePath(char *path, int size, const char *dir, const char *ext,
+                      unsigned long long key)
+{
+    snprintf(path, size, "%s/%016llx.%s", dir, key, ext);
+}
+
+FILE *cacheOpen(const char *dir, const char *ext, unsigned long long key, int *length)
+{
+#ifndef _WIN32
+    KeptEntry *kept = findKept(dir, ext, key);
+    if (kept != NULL && kept->length > 0) {
+        FILE *file = fmemopen(kept->data + sizeof(CacheHeader), kept->length, "rb");
+        if (file != NULL) {
+            *length = kept->length;
+            return file;
+        }
+    }
+#endif
+
+    char path[1024];
+    cachePath(path, sizeof(path), dir, ext, key);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    CacheHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+        header.key != key || header.length < 0) {
+        fclose(file);
+        return NULL;
+    }
+    *length = header.length;
+    reportUsed(dir, ext, key);
+    return file;
+}
+
+int cacheStore(const char *dir, const char *ext, unsigned long long key,
+               const void *data, int length)
+{
+    char path[1024];
+    char tmpPath[1024 + 32];
+
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+
+    cachePath(path, sizeof(path), dir, ext, key);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int) getpid());
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+        return -1;
+
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.length = length;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (length == 0 || fwrite(data, length, 1, file) == 1);
+    ok = (fclose(file) == 0) && ok;
+
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    if (ok)
+        remove(path);
+#endif
+    if (!ok || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+    reportUsed(dir, ext, key);
+    return 0;
+}
+
+const void *cacheMap(const char *dir, const char *ext, unsigned long long key, int *length)
+{
+    KeptEntry *kept = findKept(dir, ext, key);
+    if (kept != NULL) {
+        *length = kept->length;
+        return kept->data + sizeof(CacheHeader);
+    }
+
+    char path[1024];
+    cachePath(path, sizeof(path), dir, ext, key);
+
+#ifdef _WIN32
+    FILE *file = cacheOpen(dir, ext, key, length);
+    if (file == NULL)
+        return NULL;
+    char *data = (char *) malloc(sizeof(CacheHeader) + *length);
+    int ok = fread(data + sizeof(CacheHeader), 1, *length, file) == (size_t) *length;
+    fclose(file);
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    // the whole file must be the entry, cacheUnmap() unmaps the size
+    // given in the header
+    const CacheHeader *header = (const CacheHeader *) map;
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+        header->key != key || header->length < 0 ||
+        (off_t) (sizeof(CacheHeader) + header->length) != st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *length = header->length;
+    const char *data = (const char *) map;
+#endif
+
+    // the modification time tells cacheEvict() when it was last used
+    utime(path, NULL);
+    reportUsed(dir, ext, key);
+    return data + sizeof(CacheHeader);
+}
+
+void cacheUnmap(const void *data, int length)
+{
+    if (data == NULL)
+        return;
+    char *start = (char *) data - sizeof(CacheHeader);
+    for (int i = 0; i < nroKeptEntries; i++)
+        if (keptEntries[i].data == start)
+            return;
+#ifdef _WIN32
+    (void) length;
+    free(start);
+#else
+    munmap(start, sizeof(CacheHeader) + length);
+#endif
+}
+
+int cacheKeep(const char *dir, const char *ext, unsigned long long key, long long maxBytes)
+{
+    if (findKept(dir, ext, key) != NULL)
+        return true;
+
+    int length;
+    FILE *file = cacheOpen(dir, ext, key, &length);
+    if (file == NULL)
+        return false;
+    char *data = (char *) malloc(sizeof(CacheHeader) + length + 1);
+    int ok = data != NULL &&
+        fread(data + sizeof(CacheHeader), 1, length, file) == (size_t) length;
+    fclose(file);
+    if (!ok || (long long) sizeof(CacheHeader) + length > maxBytes) {
+        free(data);
+        return false;
+    }
+
+    // the least recently used entries make room for the new one
+    while (keptBytes + (long long) sizeof(CacheHeader) + length > maxBytes) {
+        int oldest = 0;
+        for (int i = 1; i < nroKeptEntries; i++)
+            if (keptEntries[i].used < keptEntries[oldest].used)
+                oldest = i;
+        keptBytes -= sizeof(CacheHeader) + keptEntries[oldest].length;
+        free(keptEntries[oldest].dir);
+        free(keptEntries[oldest].data);
+        keptEntries[oldest] = keptEntries[--nroKeptEntries];
+    }
+
+    if (nroKeptEntries % 256 == 0)
+        keptEntries = (KeptEntry *) realloc(keptEntries, (nroKeptEntries + 256) * sizeof(KeptEntry));
+    KeptEntry *kept = &keptEntries[nroKeptEntries++];
+    kept->dir = strdup(dir);
+    snprintf(kept->ext, sizeof(kept->ext), "%s", ext);
+    kept->key = key;
+    kept->data = data;
+    kept->length = length;
+    kept->used = ++keptClock;
+    keptBytes += sizeof(CacheHeader) + length;
+    return true;
+}
+
+void cacheReport(void (*used)(const char *dir, const char *ext, unsigned long long key))
+{
+    usedFunct = used;
+}
+
+// an entry found by cacheEvict()
+typedef struct
+{
+    char name[32];
+    long long size;
+    double used;
+} CacheFile;
+
+static int compareUsed(const void *a, const void *b)
+{
+    double usedA = ((const CacheFile *) a)->used;
+    double usedB = ((const CacheFile *) b)->used;
+    return (usedA > usedB) - (usedA < usedB);
+}
+
+int cacheEvict(const char *dir, const char *ext, long long maxBytes)
+{
+    char path[1024];
+
+#ifndef _WIN32
+    // only one process evicts at a time, the others skip it
+    snprintf(path, sizeof(path), "%s/lock", dir);
+    int lock = open(path, O_CREAT | O_RDWR, 0666);
+    if (lock < 0)
+        return 0;
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        close(lock);
+        return 0;
+    }
+#endif
+
+    CacheFile *files = NULL;
+    int nroFiles = 0;
+    long long total = 0;
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+        // only entries named by cachePath(), not temporary files
+        const char *name = entry->d_name;
+        if (strlen(name) != 17 + strlen(ext) || name[16] != '.' || strcmp(name + 17, ext) != 0)
+            continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (stat(path, &st) != 0)
+            continue;
+        if (nroFiles % 256 == 0)
+            files = (CacheFile *) realloc(files, (nroFiles + 256) * sizeof(CacheFile));
+        snprintf(files[nroFiles].name, sizeof(files[nroFiles].name), "%s", name);
+        files[nroFiles].size = st.st_size;
+        files[nroFiles].used = st.st_mtime;
+#ifdef __linux__
+        files[nroFiles].used += st.st_mtim.tv_nsec / 1e9;
+#endif
+        total += st.st_size;
+        nroFiles++;
+    }
+    if (d != NULL)
+        closedir(d);
+
+    // the least recently used entries are removed first. An entry that
+    // another process has mapped stays valid until it is unmapped.
+    int removed = 0;
+    if (total > maxBytes) {
+        qsort(files, nroFiles, sizeof(CacheFile), compareUsed);
+        for (int i = 0; i < nroFiles && total > maxBytes; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+            if (remove(path) == 0) {
+                total -= files[i].size;
+                removed++;
+            }
+        }
+    }
+    free(files);
+
+#ifndef _WIN32
+    flock(lock, LOCK_UN);
+    close(lock);
+#endif
+    return removed;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+
+// Content-addressed disk cache. Entries are stored in a directory as
+// files named by the hex key and an extension telling what kind of
+// data they hold. Each file starts with a small header that repeats
+// the key, so a hash collision on the file name is detected.
+
+// 64-bit FNV-1a hash, chained by passing the previous hash as seed
+#define HASH_SEED 0xcbf29ce484222325ULL
+unsigned long long hashBytes(const void *data, int length, unsigned long long seed);
+unsigned long long hashInt(int value, unsigned long long seed);
+
+// opens a cache entry for reading, returns NULL if there is no valid
+// entry. On success the file is positioned at the start of the data
+// and length is set to the data length. Caller must fclose() it.
+FILE *cacheOpen(const char *dir, const char *ext, unsigned long long key, int *length);
+
+// stores a cache entry, returns 0 on success. The entry is written to
+// a temporary file and renamed into place, so readers never see a
+// partially written entry.
+int cacheStore(const char *dir, const char *ext, unsigned long long key,
+               const void *data, int length);
+
+// maps a cache entry to memory, returns a pointer to the data or NULL
+// if there is no valid entry. The data stays valid even if the entry
+// is replaced or evicted meanwhile. Release it with cacheUnmap().
+const void *cacheMap(const char *dir, const char *ext, unsigned long long key, int *length);
+void cacheUnmap(const void *data, int length);
+
+// Entries can also be kept in the memory of the process: after
+// cacheKeep() has read an entry, cacheOpen() and cacheMap() find it
+// there without the file, also in the processes forked later. The
+// least recently used kept entries are dropped to keep them under
+// maxBytes. Returns false if there is no valid entry.
+int cacheKeep(const char *dir, const char *ext, unsigned long long key, long long maxBytes);
+
+// used() is called with every entry that is read from a file or stored
+// by this process, NULL (default) stops it
+void cacheReport(void (*used)(const char *dir, const char *ext, unsigned long long key));
+
+// removes the least recently used entries with given extension until
+// they take at most maxBytes. Returns the number of removed entries.
+// If another process is evicting at the same time nothing is done.
+int cacheEvict(const char *dir, const char *ext, long long maxBytes);
+
+#endif
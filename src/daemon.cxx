@@ -0,0 +1,715 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "cache.h"
+#include "daemon.h"
+
+// look daemon.h for function definitions
+
+#define MAX_LINE 4096
+#define MAX_OPTIONS 256
+
+// the cache entries kept in memory take at most this
+#define KEPT_BYTES (256LL * 1024 * 1024)
+
+#ifndef _WIN32
+static int socketAddress(const char *socketPath, struct sockaddr_un *address)
+{
+    if (strlen(socketPath) >= sizeof(address->sun_path)) {
+        printf("ERROR: socket path is too long: %s\n", socketPath);
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socketPath);
+    return true;
+}
+#endif
+
+#ifndef _WIN32
+// the report pipe of a process serving a connection, and the part of
+// the last line that hasn't been read yet
+typedef struct
+{
+    int fd;
+    int length;
+    char line[MAX_LINE];
+} Reporter;
+
+// reads what the process has written, returns false at the end
+static int readReport(Reporter *reporter, void (*report)(char *line))
+{
+    int n = read(reporter->fd, reporter->line + reporter->length,
+                 MAX_LINE - 1 - reporter->length);
+    if (n < 0 && errno == EINTR)
+        return true;
+    if (n <= 0)
+        return false;
+    reporter->length += n;
+
+    char *start = reporter->line;
+    char *end;
+    while ((end = (char *) memchr(start, '\n', reporter->line + reporter->length - start)) != NULL) {
+        *end = '\0';
+        report(start);
+        start = end + 1;
+    }
+    reporter->length -= start - reporter->line;
+    memmove(reporter->line, start, reporter->length);
+
+    // a line that doesn't fit is dropped
+    if (reporter->length == MAX_LINE - 1)
+        reporter->length = 0;
+    return true;
+}
+#endif
+
+int serveClients(const char *socketPath, void (*serve)(int fd, int report),
+                 void (*report)(char *line))
+{
+#ifdef _WIN32
+    (void) socketPath;
+    (void) serve;
+    (void) report;
+    printf("ERROR: the daemon is not supported on this platform\n");
+    return false;
+#else
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address))
+        return false;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        printf("ERROR: can't create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // a socket left by a daemon that didn't exit cleanly
+    unlink(socketPath);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(listener, 64) < 0) {
+        printf("ERROR: can't listen on %s: %s\n", socketPath, strerror(errno));
+        close(listener);
+        return false;
+    }
+
+    // the processes of the clients are not waited for, the end of their
+    // report pipe tells that they are done
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    Reporter **reporters = NULL;
+    int nroReporters = 0;
+    struct pollfd *fds = NULL;
+    for (;;) {
+        fds = (struct pollfd *) realloc(fds, (nroReporters + 1) * sizeof(struct pollfd));
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < nroReporters; i++) {
+            fds[i + 1].fd = reporters[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, nroReporters + 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("ERROR: can't poll: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = nroReporters - 1; i >= 0; i--) {
+            if (fds[i + 1].revents == 0 || readReport(reporters[i], report))
+                continue;
+            close(reporters[i]->fd);
+            free(reporters[i]);
+            reporters[i] = reporters[--nroReporters];
+        }
+        if (fds[0].revents == 0)
+            continue;
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            printf("ERROR: can't accept connection: %s\n", strerror(errno));
+            break;
+        }
+        int pipeFds[2];
+        if (pipe(pipeFds) < 0) {
+            printf("ERROR: can't create pipe: %s\n", strerror(errno));
+            close(fd);
+            continue;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            close(pipeFds[0]);
+            for (int i = 0; i < nroReporters; i++)
+                close(reporters[i]->fd);
+            serve(fd, pipeFds[1]);
+            close(fd);
+            exit(0);
+        }
+        close(pipeFds[1]);
+        if (pid < 0) {
+            printf("ERROR: can't fork: %s\n", strerror(errno));
+            close(pipeFds[0]);
+        }
+        else {
+            reporters = (Reporter **) realloc(reporters, (nroReporters + 1) * sizeof(Reporter *));
+            reporters[nroReporters] = (Reporter *) malloc(sizeof(Reporter));
+            reporters[nroReporters]->fd = pipeFds[0];
+            reporters[nroReporters]->length = 0;
+            nroReporters++;
+        }
+        close(fd);
+    }
+
+    for (int i = 0; i < nroReporters; i++) {
+        close(reporters[i]->fd);
+        free(reporters[i]);
+    }
+    free(reporters);
+    free(fds);
+    close(listener);
+    return false;
+#endif
+}
+
+int connectDaemon(const char *socketPath)
+{
+#ifdef _WIN32
+    (void) socketPath;
+    printf("ERROR: the daemon is not supported on this platform\n");
+    return -1;
+#else
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return fd;
+#endif
+}
+
+// reads a line without the newline, returns false at the end of input
+static int readLine(FILE *in, char *line)
+{
+    if (fgets(line, MAX_LINE, in) == NULL)
+        return false;
+    int length = strlen(line);
+    if (length == 0 || line[length - 1] != '\n')
+        return false;
+    line[length - 1] = '\0';
+    return true;
+}
+
+int readRequest(FILE *in, DaemonRequest *request)
+{
+    char line[MAX_LINE];
+    memset(request, 0, sizeof(*request));
+    if (!readLine(in, line))
+        return false;
+    if (strncmp("file ", line, 5) == 0)
+        request->path = strdup(line + 5);
+    else if (strncmp("data ", line, 5) == 0) {
+        request->length = atoi(line + 5);
+        if (request->length <= 0)
+            return false;
+    }
+    else
+        return false;
+
+    request->options = (char **) malloc(MAX_OPTIONS * sizeof(char *));
+    for (;;) {
+        if (!readLine(in, line))
+            return false;
+        if (line[0] == '\0')
+            break;
+        if (request->nroOptions == MAX_OPTIONS)
+            return false;
+        request->options[request->nroOptions++] = strdup(line);
+    }
+
+    if (request->path == NULL) {
+        request->data = (char *) malloc(request->length);
+        if (request->data == NULL ||
+            (int) fread(request->data, 1, request->length, in) != request->length)
+            return false;
+    }
+    return true;
+}
+
+int writeAll(int fd, const void *data, int length)
+{
+#ifdef _WIN32
+    (void) fd;
+    (void) data;
+    (void) length;
+    return false;
+#else
+    const char *ptr = (const char *) data;
+    while (length > 0) {
+        int n = write(fd, ptr, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        length -= n;
+    }
+    return true;
+#endif
+}
+
+int writeRequest(int fd, const DaemonRequest *request)
+{
+    char line[MAX_LINE];
+    if (request->path != NULL)
+        snprintf(line, sizeof(line), "file %s\n", request->path);
+    else
+        snprintf(line, sizeof(line), "data %d\n", request->length);
+    if (!writeAll(fd, line, strlen(line)))
+        return false;
+    for (int i = 0; i < request->nroOptions; i++) {
+        if (!writeAll(fd, request->options[i], strlen(request->options[i])) ||
+            !writeAll(fd, "\n", 1))
+            return false;
+    }
+    if (!writeAll(fd, "\n", 1))
+        return false;
+    return request->path != NULL || writeAll(fd, request->data, request->length);
+}
+
+void freeRequest(DaemonRequest *request)
+{
+    for (int i = 0; i < request->nroOptions; i++)
+        free(request->options[i]);
+    free(request->options);
+    free(request->path);
+    free(request->data);
+}
+
+int writeSection(int fd, const char *name, const void *data, int length)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%s %d\n", name, length);
+    return writeAll(fd, line, strlen(line)) && (data == NULL || writeAll(fd, data, length));
+}
+
+int readSection(FILE *in, const char *name, int *length)
+{
+    char line[MAX_LINE];
+    int nameLength = strlen(name);
+    if (!readLine(in, line) || strncmp(line, name, nameLength) != 0 || line[nameLength] != ' ')
+        return false;
+    *length = atoi(line + nameLength + 1);
+    return *length >= 0;
+}
+
+int inDirectory(const char *path, const char *dir)
+{
+#ifdef _WIN32
+    (void) path;
+    (void) dir;
+    return false;
+#else
+    char resolvedPath[PATH_MAX];
+    char resolvedDir[PATH_MAX];
+    if (realpath(path, resolvedPath) == NULL || realpath(dir, resolvedDir) == NULL)
+        return false;
+    int length = strlen(resolvedDir);
+    if (resolvedDir[length - 1] == '/')
+        length--;
+    return strncmp(resolvedPath, resolvedDir, length) == 0 && resolvedPath[length] == '/';
+#endif
+}
+
+#ifndef _WIN32
+// In daemon mode every request is served by a process of its own that
+// runs the parser with the options of the daemon and the request. The
+// output and the messages go to a temporary directory and are sent
+// back from there.
+static int daemonArgc = 0;
+static char **daemonArgv = NULL;
+static int (*compileFunct)(int argc, char *argv[]) = NULL;
+static char *(*namesFunct)(int *count, int *length) = NULL;
+
+// the working directory of the daemon, the files of the requests must
+// be in it
+static char daemonRoot[PATH_MAX];
+
+// connection whose response hasn't been sent yet, -1 if none
+static int daemonClient = -1;
+static char daemonDir[64];
+
+// the cache entries the request used are written here for the daemon
+static FILE *daemonReport = NULL;
+
+// the options a client can give: they select the VT and the format of
+// the pool, but don't name files
+static const char *clientOptions[] = {
+    "-d=", "-sw=", "-sh=", "-c=", "-max-size=", "-renumber=", "-renumber",
+    "-table", "-python", "-dedup", "-prune", "-macros", "-compress", NULL
+};
+
+static int clientOption(const char *option)
+{
+    for (int i = 0; clientOptions[i] != NULL; i++) {
+        int length = strlen(clientOptions[i]);
+        if (clientOptions[i][length - 1] == '=' ? strncmp(option, clientOptions[i], length) == 0
+                                                : strcmp(option, clientOptions[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+// reads a whole file, returns NULL if it can't be read
+static char *readFile(const char *fileName, int *length)
+{
+    *length = 0;
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+    char *data = (char *) malloc(*length + 1);
+    if (data == NULL || (int) fread(data, 1, *length, file) != *length) {
+        free(data);
+        data = NULL;
+        *length = 0;
+    }
+    fclose(file);
+    return data;
+}
+
+// removes the temporary directory of a request and the files in it
+static void removeDir(const char *dir)
+{
+    DIR *handle = opendir(dir);
+    if (handle != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(handle)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            char fileName[1024];
+            snprintf(fileName, sizeof(fileName), "%s/%s", dir, entry->d_name);
+            unlink(fileName);
+        }
+        closedir(handle);
+    }
+    rmdir(dir);
+}
+
+// sends the messages, the output file and the symbol table to the
+// client of the request
+static void sendResponse(int ok)
+{
+    int fd = daemonClient;
+    daemonClient = -1;
+    fflush(stdout);
+
+    char fileName[1024];
+    int logLength;
+    int poolLength;
+    snprintf(fileName, sizeof(fileName), "%s/log", daemonDir);
+    char *log = readFile(fileName, &logLength);
+    snprintf(fileName, sizeof(fileName), "%s/pool", daemonDir);
+    char *pool = readFile(fileName, &poolLength);
+
+    int nroNames = 0;
+    int namesLength = 0;
+    char *names = ok ? namesFunct(&nroNames, &namesLength) : NULL;
+
+    writeSection(fd, "status", NULL, ok && pool != NULL);
+    writeSection(fd, "log", log, logLength);
+    writeSection(fd, "pool", pool, poolLength);
+    writeSection(fd, "names", NULL, nroNames);
+    writeAll(fd, names, namesLength);
+    free(names);
+    free(pool);
+    free(log);
+    removeDir(daemonDir);
+}
+
+// sends the response if the parser exits on an error
+static void exitResponse()
+{
+    if (daemonClient >= 0)
+        sendResponse(false);
+}
+
+// tells the daemon a cache entry the request used
+static void reportEntry(const char *dir, const char *ext, unsigned long long key)
+{
+    fprintf(daemonReport, "%s %016llx %s\n", ext, key, dir);
+}
+
+// keeps a cache entry a request reported in memory
+static void keepEntry(char *line)
+{
+    char ext[8];
+    unsigned long long key;
+    int dirStart;
+    if (sscanf(line, "%7s %llx %n", ext, &key, &dirStart) == 2 && line[dirStart] != '\0')
+        cacheKeep(line + dirStart, ext, key, KEPT_BYTES);
+}
+
+// serves one request in the process of the connection
+static void serveRequest(int fd, int report)
+{
+    DaemonRequest request;
+    FILE *in = fdopen(dup(fd), "rb");
+    int ok = in != NULL && readRequest(in, &request);
+    if (in != NULL)
+        fclose(in);
+
+    // the options are checked before anything is done
+    const char *message = "ERROR: invalid request\n";
+    char buffer[2 * PATH_MAX + 64];
+    char path[PATH_MAX];
+    for (int i = 0; ok && i < request.nroOptions; i++) {
+        if (!clientOption(request.options[i])) {
+            snprintf(buffer, sizeof(buffer), "ERROR: %s can't be given to the daemon\n",
+                     request.options[i]);
+            message = buffer;
+            ok = false;
+        }
+    }
+    if (ok && request.path != NULL) {
+        if (realpath(request.path, path) == NULL)
+            snprintf(buffer, sizeof(buffer), "Can't open file: %s\n", request.path);
+        else if (!inDirectory(path, daemonRoot))
+            snprintf(buffer, sizeof(buffer), "ERROR: %s is not in %s\n", path, daemonRoot);
+        else
+            buffer[0] = '\0';
+        if (buffer[0] != '\0') {
+            message = buffer;
+            ok = false;
+        }
+    }
+
+    snprintf(daemonDir, sizeof(daemonDir), "/tmp/pooleditparser.XXXXXX");
+    if (ok && mkdtemp(daemonDir) == NULL) {
+        message = "ERROR: can't create a temporary directory\n";
+        ok = false;
+    }
+    if (!ok) {
+        writeSection(fd, "status", NULL, 0);
+        writeSection(fd, "log", message, strlen(message));
+        writeSection(fd, "pool", NULL, 0);
+        writeSection(fd, "names", NULL, 0);
+        return;
+    }
+
+    char logName[1024];
+    char inputName[1024];
+    char outputName[1024];
+    snprintf(logName, sizeof(logName), "%s/log", daemonDir);
+    snprintf(inputName, sizeof(inputName), "%s/input", daemonDir);
+    snprintf(outputName, sizeof(outputName), "%s/pool", daemonDir);
+    daemonClient = fd;
+    atexit(exitResponse);
+    if (freopen(logName, "w", stdout) == NULL) {
+        sendResponse(false);
+        return;
+    }
+
+    // the lines are written at once, the daemon reads them meanwhile
+    daemonReport = fdopen(report, "w");
+    if (daemonReport != NULL) {
+        setvbuf(daemonReport, NULL, _IOLBF, MAX_LINE);
+        cacheReport(reportEntry);
+    }
+
+    if (request.path == NULL) {
+        FILE *file = fopen(inputName, "wb");
+        if (file == NULL || (int) fwrite(request.data, 1, request.length, file) != request.length) {
+            printf("Can't write file: %s\n", inputName);
+            sendResponse(false);
+            return;
+        }
+        fclose(file);
+    }
+
+    int argc = 3 + daemonArgc + request.nroOptions;
+    char **argv = (char **) malloc((argc + 1) * sizeof(char *));
+    argv[0] = (char *) "pooleditparser";
+    argv[1] = request.path ? path : inputName;
+    argv[2] = outputName;
+    for (int i = 0; i < daemonArgc; i++)
+        argv[3 + i] = daemonArgv[i];
+    for (int i = 0; i < request.nroOptions; i++)
+        argv[3 + daemonArgc + i] = request.options[i];
+    argv[argc] = NULL;
+
+    int result = compileFunct(argc, argv);
+    sendResponse(result == 0);
+}
+#endif
+
+int runDaemon(int argc, char *argv[], int (*compile)(int argc, char *argv[]),
+              char *(*names)(int *count, int *length))
+{
+#ifdef _WIN32
+    (void) argc;
+    (void) argv;
+    (void) compile;
+    (void) names;
+    printf("ERROR: -daemon is not supported on this platform\n");
+    return -1;
+#else
+    const char *socketPath = argv[1] + 8;
+    compileFunct = compile;
+    namesFunct = names;
+    if (getcwd(daemonRoot, sizeof(daemonRoot)) == NULL) {
+        printf("ERROR: can't get the working directory: %s\n", strerror(errno));
+        return -2;
+    }
+
+    // the caches keep the documents, pictures and pools between the
+    // requests, if the options don't name other directories. The
+    // fragments must be in the working directory too.
+    static char cacheDir[1024];
+    static char pictureCache[1100];
+    static char poolCache[1100];
+    static char documentCache[1100];
+    static char includeRoot[PATH_MAX + 16];
+    snprintf(cacheDir, sizeof(cacheDir), "%s.cache", socketPath);
+    snprintf(pictureCache, sizeof(pictureCache), "-cache=%s", cacheDir);
+    snprintf(poolCache, sizeof(poolCache), "-pool-cache=%s", cacheDir);
+    snprintf(documentCache, sizeof(documentCache), "-document-cache=%s", cacheDir);
+    snprintf(includeRoot, sizeof(includeRoot), "-include-root=%s", daemonRoot);
+    char *defaults[] = { pictureCache, poolCache, documentCache, includeRoot };
+
+    daemonArgv = (char **) malloc((argc + 4) * sizeof(char *));
+    for (int i = 2; i < argc; i++)
+        daemonArgv[daemonArgc++] = argv[i];
+    for (int i = 0; i < 4; i++) {
+        int length = strchr(defaults[i], '=') - defaults[i] + 1;
+        int found = false;
+        for (int j = 2; j < argc; j++)
+            if (strncmp(defaults[i], argv[j], length) == 0)
+                found = true;
+        if (!found)
+            daemonArgv[daemonArgc++] = defaults[i];
+    }
+
+    printf("* daemon listening on %s\n", socketPath);
+    for (int i = 0; i < daemonArgc; i++)
+        printf("* option: %s\n", daemonArgv[i]);
+    return serveClients(socketPath, serveRequest, keepEntry) ? 0 : -2;
+#endif
+}
+
+int runClient(int argc, char *argv[], const char *socketPath)
+{
+#ifdef _WIN32
+    (void) argc;
+    (void) argv;
+    (void) socketPath;
+    printf("ERROR: -connect is not supported on this platform\n");
+    return -1;
+#else
+    // the daemon may have another working directory
+    char path[PATH_MAX];
+    if (realpath(argv[1], path) == NULL) {
+        printf("Can't open file: %s\n", argv[1]);
+        return -2;
+    }
+    DaemonRequest request;
+    memset(&request, 0, sizeof(request));
+    request.path = path;
+    request.options = (char **) malloc(argc * sizeof(char *));
+    for (int i = 3; i < argc; i++)
+        if (strncmp("-connect=", argv[i], 9) != 0)
+            request.options[request.nroOptions++] = argv[i];
+
+    int fd = connectDaemon(socketPath);
+    if (fd < 0) {
+        printf("ERROR: can't connect to %s\n", socketPath);
+        return -2;
+    }
+    int ok = writeRequest(fd, &request);
+    free(request.options);
+
+    FILE *in = fdopen(fd, "rb");
+    int status = 0;
+    int length = 0;
+    ok = ok && in != NULL && readSection(in, "status", &status) && readSection(in, "log", &length);
+    char *data = NULL;
+    if (ok) {
+        data = (char *) malloc(length + 1);
+        ok = (int) fread(data, 1, length, in) == length;
+        if (ok)
+            fwrite(data, 1, length, stdout);
+        free(data);
+    }
+    ok = ok && readSection(in, "pool", &length);
+    if (ok) {
+        data = (char *) malloc(length + 1);
+        ok = (int) fread(data, 1, length, in) == length;
+    }
+    if (in != NULL)
+        fclose(in);
+    else
+        close(fd);
+    if (!ok) {
+        printf("ERROR: invalid response from %s\n", socketPath);
+        free(data);
+        return -2;
+    }
+
+    // with -table and -python the names are in the output already
+    if (status) {
+        FILE *file = fopen(argv[2], "wb");
+        if (file == NULL || (int) fwrite(data, 1, length, file) != length) {
+            printf("Can't write file: %s\n", argv[2]);
+            free(data);
+            return -3;
+        }
+        fclose(file);
+    }
+    free(data);
+    return status ? 0 : -4;
+#endif
+}
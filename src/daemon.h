@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+
+// Compile daemon. The daemon listens on a UNIX domain socket and forks
+// a process for every client, so several clients are served at the
+// same time and a request that fails doesn't stop the daemon. The
+// cache entries (pictures, documents and pools) a request used are
+// kept in the memory of the daemon, so the next requests get them
+// without reading the files.
+//
+// A request is a header of text lines and the document:
+//
+//   file <path>          the XML or IR file to compile, or
+//   data <length>        the document follows the header
+//   <option>             options, one per line, like on the command line
+//   (empty line)
+//
+// A client can only give the options that select the VT and the format
+// of the pool (-d=, -sw=, -sh=, -c=, -max-size=, -table, -python,
+// -dedup, -prune, -macros, -renumber and -compress). The files and
+// directories are set on the command line of the daemon, and the file
+// of a request must be in the working directory of the daemon.
+//
+// The response is a list of sections, each a line "<name> <length>"
+// followed by length bytes, except names where length is the number
+// of "<id> <name>" lines that follow:
+//
+//   status <0 or 1>      (no data) 1 if the pool was generated
+//   log <length>         the messages of the parser
+//   pool <length>        the output file
+//   names <count>        the symbol table
+
+// a request of a client
+typedef struct
+{
+    char *path;     // file to compile, NULL if the document is in data
+    char *data;
+    int length;
+    int nroOptions;
+    char **options;
+} DaemonRequest;
+
+// listens on the socket and calls serve() in a new process for every
+// connection. The lines the process writes to the report descriptor
+// are given to report() in the daemon. Returns only on error.
+int serveClients(const char *socketPath, void (*serve)(int fd, int report),
+                 void (*report)(char *line));
+
+// connects to a daemon, returns the socket or -1 on error
+int connectDaemon(const char *socketPath);
+
+// reads and writes requests, return false on error
+int readRequest(FILE *in, DaemonRequest *request);
+int writeRequest(int fd, const DaemonRequest *request);
+void freeRequest(DaemonRequest *request);
+
+// writes a "<name> <length>" line and the data, returns false on error
+int writeSection(int fd, const char *name, const void *data, int length);
+int writeAll(int fd, const void *data, int length);
+
+// reads a "<name> <length>" line, returns false if the next line isn't
+// one with the given name
+int readSection(FILE *in, const char *name, int *length);
+
+// runs the daemon, the options are used with every request. compile()
+// is called in the process of a request like main(), and names()
+// returns the symbol table of the pool it compiled as "<id> <name>"
+// lines.
+int runDaemon(int argc, char *argv[], int (*compile)(int argc, char *argv[]),
+              char *(*names)(int *count, int *length));
+
+// sends the input file and the options to a daemon, and writes the
+// pool it sent to the output file
+int runClient(int argc, char *argv[], const char *socketPath);
+
+// returns true if the file is in the directory or below it
+int inDirectory(const char *path, const char *dir);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "index.h"
+
+// look index.h for function definitions
+
+typedef struct
+{
+    pool_sink_t sink;     // must be first
+    pool_sink_t *next;
+    IndexEntry *entries;
+    int count;
+    int capacity;
+    unsigned int offset;
+} IndexSink;
+
+void indexSinkWrite(pool_sink_t *sink, const pool_span_t *spans, int count)
+{
+    IndexSink *x = (IndexSink *) sink;
+
+    if (x->count + count > x->capacity) {
+        while (x->count + count > x->capacity)
+            x->capacity = x->capacity ? 2 * x->capacity : 256;
+        x->entries = (IndexEntry *) realloc(x->entries, x->capacity * sizeof(IndexEntry));
+        if (x->entries == NULL) {
+            printf("out of memory!\n");
+            exit(-1);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data = (const unsigned char *) spans[i].data;
+        IndexEntry *entry = &x->entries[x->count++];
+        entry->objectId = data[0] | (data[1] << 8);
+        entry->type = data[2];
+        entry->reserved = 0;
+        entry->offset = x->offset;
+        entry->size = spans[i].length;
+        entry->hash = hashBytes(data, spans[i].length, HASH_SEED);
+        x->offset += spans[i].length;
+        x->next->size += spans[i].length;
+    }
+    x->next->objects += count;
+    x->next->write(x->next, spans, count);
+}
+
+pool_sink_t *open_index_sink(pool_sink_t *next)
+{
+    IndexSink *x = (IndexSink *) calloc(1, sizeof(IndexSink));
+    x->next = next;
+    x->sink.write = indexSinkWrite;
+    return &x->sink;
+}
+
+int compareIndexEntries(const void *a, const void *b)
+{
+    const IndexEntry *x = (const IndexEntry *) a;
+    const IndexEntry *y = (const IndexEntry *) b;
+    if (x->objectId != y->objectId)
+        return x->objectId - y->objectId;
+    return (x->offset < y->offset) ? -1 : (x->offset > y->offset);
+}
+
+int write_index_sink(pool_sink_t *sink, FILE *file, unsigned int fileSize)
+{
+    IndexSink *x = (IndexSink *) sink;
+    qsort(x->entries, x->count, sizeof(IndexEntry), compareIndexEntries);
+
+    IndexHeader header;
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.entrySize = sizeof(IndexEntry);
+    header.count = x->count;
+    header.poolSize = x->offset;
+    header.fileSize = fileSize;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && (int) fwrite(x->entries, sizeof(IndexEntry), x->count, file) == x->count;
+
+    free(x->entries);
+    free(x);
+    return ok;
+}
+
+int close_index_sink(pool_sink_t *sink, const char *fileName, unsigned int fileSize)
+{
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) {
+        IndexSink *x = (IndexSink *) sink;
+        free(x->entries);
+        free(x);
+        return false;
+    }
+    int ok = write_index_sink(sink, file, fileSize);
+    return (fclose(file) == 0) && ok;
+}
+
+const IndexEntry *findIndexEntry(const IndexEntry *entries, int count, int objectId)
+{
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (entries[middle].objectId < objectId)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < count && entries[low].objectId == objectId)
+        return &entries[low];
+    return NULL;
+}
+
+IndexEntry *readIndex(const char *fileName, int *count, unsigned int *fileSize)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+        return NULL;
+
+    IndexHeader header;
+    IndexEntry *entries = NULL;
+    if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == INDEX_MAGIC &&
+        header.version == INDEX_VERSION && header.entrySize == sizeof(IndexEntry)) {
+        entries = (IndexEntry *) malloc((header.count + 1) * sizeof(IndexEntry));
+        if (fread(entries, sizeof(IndexEntry), header.count, file) != header.count) {
+            free(entries);
+            entries = NULL;
+        }
+    }
+    fclose(file);
+
+    if (entries != NULL) {
+        *count = header.count;
+        *fileSize = header.fileSize;
+    }
+    return entries;
+}
+
+typedef struct
+{
+    pool_sink_t sink;     // must be first
+    pool_sink_t *next;
+    const IndexEntry *previous;
+    int previousCount;
+    unsigned char seen[65536];
+
+    // objects passed on and if they were changed (not added)
+    unsigned short *ids;
+    unsigned char *changed;
+    int count;
+    int capacity;
+    int unchanged;
+} DeltaSink;
+
+void deltaSinkWrite(pool_sink_t *sink, const pool_span_t *spans, int count)
+{
+    DeltaSink *x = (DeltaSink *) sink;
+
+    if (x->count + count > x->capacity) {
+        while (x->count + count > x->capacity)
+            x->capacity = x->capacity ? 2 * x->capacity : 256;
+        x->ids = (unsigned short *) realloc(x->ids, x->capacity * sizeof(unsigned short));
+        x->changed = (unsigned char *) realloc(x->changed, x->capacity);
+        if (x->ids == NULL || x->changed == NULL) {
+            printf("out of memory!\n");
+            exit(-1);
+        }
+    }
+
+    // the spans are compacted to the objects that are passed on
+    pool_span_t *passed = (pool_span_t *) malloc(count * sizeof(pool_span_t));
+    int nroPassed = 0;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data = (const unsigned char *) spans[i].data;
+        int objectId = data[0] | (data[1] << 8);
+        x->seen[objectId] = 1;
+
+        const IndexEntry *old = findIndexEntry(x->previous, x->previousCount, objectId);
+        if (old != NULL && old->size == (unsigned int) spans[i].length &&
+            old->hash == hashBytes(data, spans[i].length, HASH_SEED)) {
+            x->unchanged++;
+            continue;
+        }
+        x->ids[x->count] = objectId;
+        x->changed[x->count] = old != NULL;
+        x->count++;
+        passed[nroPassed++] = spans[i];
+        x->next->size += spans[i].length;
+    }
+    x->next->objects += nroPassed;
+    if (nroPassed > 0)
+        x->next->write(x->next, passed, nroPassed);
+    free(passed);
+}
+
+pool_sink_t *open_delta_sink(pool_sink_t *next, const IndexEntry *previous, int count)
+{
+    DeltaSink *x = (DeltaSink *) calloc(1, sizeof(DeltaSink));
+    x->next = next;
+    x->previous = previous;
+    x->previousCount = count;
+    x->sink.write = deltaSinkWrite;
+    return &x->sink;
+}
+
+int close_delta_sink(pool_sink_t *sink, const char *fileName, DeltaCounts *counts)
+{
+    DeltaSink *x = (DeltaSink *) sink;
+
+    memset(counts, 0, sizeof(DeltaCounts));
+    counts->unchanged = x->unchanged;
+    int ok = false;
+    FILE *file = fopen(fileName, "w");
+    if (file != NULL) {
+        fprintf(file, "# kind object-id\n");
+        for (int i = 0; i < x->count; i++) {
+            fprintf(file, "%s %d\n", x->changed[i] ? "changed" : "added", x->ids[i]);
+            if (x->changed[i])
+                counts->changed++;
+            else
+                counts->added++;
+        }
+        // the entries are sorted by id, an id is listed only once
+        for (int i = 0; i < x->previousCount; i++) {
+            int objectId = x->previous[i].objectId;
+            if (x->seen[objectId] || (i > 0 && x->previous[i - 1].objectId == objectId))
+                continue;
+            fprintf(file, "deleted %d\n", objectId);
+            counts->deleted++;
+        }
+        ok = (fclose(file) == 0);
+    }
+
+    free(x->ids);
+    free(x->changed);
+    free(x);
+    return ok;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+
+#include "parser.h"
+
+// Index file of a binary pool. It starts with a header followed by one
+// entry per object, sorted by object id (objects with the same id in
+// pool order), so that an object can be found with a binary search
+// after the file has been mapped to memory. All values are little
+// endian.
+//
+// The index always describes the whole pool, also when the file holds
+// only the changed objects (-delta) or is compressed. The size of the
+// file is recorded separately, so that the file and its index can be
+// the base of the next delta.
+
+#define INDEX_MAGIC 0x49504550  // "PEPI"
+#define INDEX_VERSION 2
+
+#pragma pack(1)
+
+typedef struct
+{
+    unsigned int   magic;
+    unsigned short version;
+    unsigned short entrySize;   // sizeof(IndexEntry)
+    unsigned int   count;       // number of entries
+    unsigned int   poolSize;
+    unsigned int   fileSize;    // size of the file the pool was written to
+} IndexHeader;
+
+typedef struct
+{
+    unsigned short     objectId;
+    unsigned char      type;
+    unsigned char      reserved;
+    unsigned int       offset;  // offset of the object in the pool
+    unsigned int       size;
+    unsigned long long hash;    // hashBytes() of the object, see cache.h
+} IndexEntry;
+
+#pragma pack()
+
+// creates a sink that records the objects for the index and passes
+// them on to next
+pool_sink_t *open_index_sink(pool_sink_t *next);
+
+// writes the index file and frees the sink (next is not closed).
+// fileSize is the size of the file the pool was written to. Returns
+// false if the file can't be written.
+int close_index_sink(pool_sink_t *sink, const char *fileName, unsigned int fileSize);
+
+// like close_index_sink(), but writes the index to an open file at its
+// current position
+int write_index_sink(pool_sink_t *sink, FILE *file, unsigned int fileSize);
+
+// returns the first entry of given object id, NULL if there is none
+const IndexEntry *findIndexEntry(const IndexEntry *entries, int count, int objectId);
+
+// reads an index file, returns the entries (free them with free()) or
+// NULL if the file is not a valid index. fileSize is set to the size
+// of the file the index was written with.
+IndexEntry *readIndex(const char *fileName, int *count, unsigned int *fileSize);
+
+// Delta pool: only the objects that are new or whose content differs
+// from the previous pool (compared by the hashes of its index) are
+// passed on, so a VT that has the previous pool can be updated with a
+// partial object pool transfer. The ids of the previous pool that are
+// no longer in the pool are listed in a manifest.
+
+typedef struct
+{
+    int added;
+    int changed;
+    int unchanged;
+    int deleted;
+} DeltaCounts;
+
+// creates a sink that passes the new and changed objects to next.
+// previous must stay valid until the sink is closed.
+pool_sink_t *open_delta_sink(pool_sink_t *next, const IndexEntry *previous, int count);
+
+// writes the manifest (one "added", "changed" or "deleted" line with
+// the object id per object) and frees the sink (next is not closed).
+// Returns false if the file can't be written.
+int close_delta_sink(pool_sink_t *sink, const char *fileName, DeltaCounts *counts);
+
+#endif
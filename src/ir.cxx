@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "cache.h"
+#include "ir.h"
+#include "../include/expat.h"
+
+// look ir.h for function definitions
+
+// Base64 decoding (see parser.cxx)
+int getDataLength(int base64Length);
+unsigned char *convertFromBase64(const char *base64, int dataLength);
+
+// growing byte buffer
+typedef struct
+{
+    unsigned char *data;
+    int length;
+    int capacity;
+} Buffer;
+
+void append(Buffer *buffer, const void *data, int length)
+{
+    if (buffer->length + length > buffer->capacity) {
+        while (buffer->length + length > buffer->capacity)
+            buffer->capacity = buffer->capacity ? 2 * buffer->capacity : 4096;
+        buffer->data = (unsigned char *) realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL) {
+            printf("out of memory!\n");
+            exit(-1);
+        }
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void appendByte(Buffer *buffer, int value)
+{
+    unsigned char byte = value;
+    append(buffer, &byte, 1);
+}
+
+void appendU16(Buffer *buffer, unsigned int value)
+{
+    unsigned char bytes[2] = {(unsigned char) value, (unsigned char) (value >> 8)};
+    append(buffer, bytes, 2);
+}
+
+void appendU32(Buffer *buffer, unsigned int value)
+{
+    unsigned char bytes[4] = {(unsigned char) value, (unsigned char) (value >> 8),
+                              (unsigned char) (value >> 16), (unsigned char) (value >> 24)};
+    append(buffer, bytes, 4);
+}
+
+unsigned int readU32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+////////// compiling //////////
+
+typedef struct
+{
+    Buffer strings;
+    Buffer records;
+    int *table;            // string offset + 1 by hash, 0 if empty
+    int tableSize;
+    int nroStrings;
+    int imageData;         // inside an image_data element
+    Buffer text;           // its Base64 data
+} IrCompiler;
+
+// returns the offset of a string in the string table, adding it if
+// needed
+unsigned int intern(IrCompiler *c, const char *string)
+{
+    int length = strlen(string);
+    if (2 * (c->nroStrings + 1) > c->tableSize) {
+        // grow and rehash
+        int oldSize = c->tableSize;
+        int *old = c->table;
+        c->tableSize = oldSize ? 2 * oldSize : 1024;
+        c->table = (int *) calloc(c->tableSize, sizeof(int));
+        for (int i = 0; i < oldSize; i++) {
+            if (old[i] == 0)
+                continue;
+            const char *s = (const char *) c->strings.data + old[i] - 1;
+            int j = hashBytes(s, strlen(s), HASH_SEED) & (c->tableSize - 1);
+            while (c->table[j] != 0)
+                j = (j + 1) & (c->tableSize - 1);
+            c->table[j] = old[i];
+        }
+        free(old);
+    }
+
+    int i = hashBytes(string, length, HASH_SEED) & (c->tableSize - 1);
+    while (c->table[i] != 0) {
+        const char *s = (const char *) c->strings.data + c->table[i] - 1;
+        if (strcmp(s, string) == 0)
+            return c->table[i] - 1;
+        i = (i + 1) & (c->tableSize - 1);
+    }
+    int offset = c->strings.length;
+    append(&c->strings, string, length + 1);
+    c->table[i] = offset + 1;
+    c->nroStrings++;
+    return offset;
+}
+
+void compileStart(void *data, const char *el, const char **attr)
+{
+    IrCompiler *c = (IrCompiler *) data;
+    int count = 0;
+    while (attr[2 * count] != NULL)
+        count++;
+
+    appendByte(&c->records, IR_START);
+    appendU32(&c->records, intern(c, el));
+    appendU16(&c->records, count);
+    for (int i = 0; i < 2 * count; i++)
+        appendU32(&c->records, intern(c, attr[i]));
+
+    if (strcmp(el, "image_data") == 0) {
+        c->imageData = 1;
+        c->text.length = 0;
+    }
+}
+
+void compileEnd(void *data, const char *el)
+{
+    IrCompiler *c = (IrCompiler *) data;
+
+    // the decoded image data comes before the end of image_data
+    if (strcmp(el, "image_data") == 0) {
+        int length = getDataLength(c->text.length);
+        unsigned char *pixels = convertFromBase64((const char *) c->text.data, length);
+        appendByte(&c->records, IR_PIXELS);
+        appendU32(&c->records, length);
+        append(&c->records, pixels, length);
+        free(pixels);
+        c->imageData = 0;
+    }
+
+    appendByte(&c->records, IR_END);
+    appendU32(&c->records, intern(c, el));
+}
+
+void compileText(void *data, const XML_Char *s, int len)
+{
+    IrCompiler *c = (IrCompiler *) data;
+    if (c->imageData)
+        append(&c->text, s, len);
+}
+
+unsigned char *compile_ir_buffer(FILE *xml, int *length)
+{
+    IrCompiler c;
+    memset(&c, 0, sizeof(c));
+
+    XML_Parser p = XML_ParserCreate(NULL);
+    XML_SetUserData(p, &c);
+    XML_SetElementHandler(p, compileStart, compileEnd);
+    XML_SetCharacterDataHandler(p, compileText);
+
+    int ok = true;
+    char buff[4096];
+    while (ok && !feof(xml)) {
+        int len = fread(buff, 1, sizeof(buff), xml);
+        if (ferror(xml)) {
+            fprintf(stderr, "Read error\n");
+            ok = false;
+        }
+        else if (!XML_Parse(p, buff, len, feof(xml))) {
+            fprintf(stderr, "Parse error at line %ld:\n%s\n",
+                    XML_GetCurrentLineNumber(p),
+                    XML_ErrorString(XML_GetErrorCode(p)));
+            ok = false;
+        }
+    }
+    XML_ParserFree(p);
+
+    unsigned char *ir = NULL;
+    if (ok) {
+        IrHeader header;
+        header.magic = IR_MAGIC;
+        header.version = IR_VERSION;
+        header.stringsOffset = sizeof(IrHeader);
+        header.stringsSize = c.strings.length;
+        header.recordsOffset = header.stringsOffset + header.stringsSize;
+        header.recordsSize = c.records.length;
+
+        *length = header.recordsOffset + header.recordsSize;
+        ir = (unsigned char *) malloc(*length);
+        if (ir == NULL) {
+            printf("out of memory!\n");
+            exit(-1);
+        }
+        memcpy(ir, &header, sizeof(header));
+        memcpy(ir + header.stringsOffset, c.strings.data, c.strings.length);
+        memcpy(ir + header.recordsOffset, c.records.data, c.records.length);
+    }
+
+    free(c.strings.data);
+    free(c.records.data);
+    free(c.text.data);
+    free(c.table);
+    return ir;
+}
+
+int compile_ir(FILE *xml, FILE *out)
+{
+    int length;
+    unsigned char *ir = compile_ir_buffer(xml, &length);
+    if (ir == NULL)
+        return false;
+    int ok = (int) fwrite(ir, 1, length, out) == length;
+    free(ir);
+    return ok;
+}
+
+////////// reading //////////
+
+const unsigned char *open_ir(FILE *file, int *length)
+{
+    IrHeader header;
+    int isIr = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == IR_MAGIC && header.version == IR_VERSION;
+    rewind(file);
+    if (!isIr)
+        return NULL;
+
+#ifdef _WIN32
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+    unsigned char *ir = (unsigned char *) malloc(*length);
+    if (ir == NULL || (int) fread(ir, 1, *length, file) != *length) {
+        free(ir);
+        return NULL;
+    }
+    return ir;
+#else
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0)
+        return NULL;
+    *length = st.st_size;
+    void *ir = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    return (ir == MAP_FAILED) ? NULL : (const unsigned char *) ir;
+#endif
+}
+
+void close_ir(const unsigned char *ir, int length)
+{
+#ifdef _WIN32
+    (void) length;
+    free((void *) ir);
+#else
+    munmap((void *) ir, length);
+#endif
+}
+
+// reads a string offset of a record. The string table ends with NUL,
+// so any offset in it gives a valid string.
+int readString(const unsigned char **p, const char *strings, unsigned int stringsSize,
+               const char **string)
+{
+    unsigned int offset = readU32(*p);
+    *p += 4;
+    if (offset >= stringsSize)
+        return false;
+    *string = strings + offset;
+    return true;
+}
+
+int replayIr(const unsigned char *ir, int length,
+             void (*start)(void *data, const char *el, const char **attr),
+             void (*end)(void *data, const char *el),
+             void (*pixels)(const unsigned char *data, int length))
+{
+    IrHeader header;
+    if (length < (int) sizeof(header))
+        return false;
+    memcpy(&header, ir, sizeof(header));
+    if (header.magic != IR_MAGIC || header.version != IR_VERSION
+        || header.stringsOffset > (unsigned int) length
+        || header.stringsSize > length - header.stringsOffset
+        || header.recordsOffset > (unsigned int) length
+        || header.recordsSize > length - header.recordsOffset
+        || (header.stringsSize > 0 && ir[header.stringsOffset + header.stringsSize - 1] != 0))
+        return false;
+
+    const char *strings = (const char *) ir + header.stringsOffset;
+    const unsigned char *p = ir + header.recordsOffset;
+    const unsigned char *recordsEnd = p + header.recordsSize;
+    const char **attr = NULL;
+    int attrCapacity = 0;
+    int ok = true;
+
+    while (ok && p < recordsEnd) {
+        int kind = *p++;
+        if (kind == IR_START) {
+            if (recordsEnd - p < 6) {
+                ok = false;
+                break;
+            }
+            const char *el;
+            if (!readString(&p, strings, header.stringsSize, &el)) {
+                ok = false;
+                break;
+            }
+            int count = p[0] | (p[1] << 8);
+            p += 2;
+            if (recordsEnd - p < 8 * count) {
+                ok = false;
+                break;
+            }
+            if (2 * count + 1 > attrCapacity) {
+                attrCapacity = 2 * count + 1;
+                attr = (const char **) realloc(attr, attrCapacity * sizeof(const char *));
+            }
+            for (int i = 0; ok && i < 2 * count; i++)
+                ok = readString(&p, strings, header.stringsSize, &attr[i]);
+            if (!ok)
+                break;
+            attr[2 * count] = NULL;
+            start(NULL, el, attr);
+        }
+        else if (kind == IR_END) {
+            if (recordsEnd - p < 4) {
+                ok = false;
+                break;
+            }
+            const char *el;
+            if (!readString(&p, strings, header.stringsSize, &el)) {
+                ok = false;
+                break;
+            }
+            end(NULL, el);
+        }
+        else if (kind == IR_PIXELS) {
+            if (recordsEnd - p < 4 || readU32(p) > (unsigned int) (recordsEnd - p - 4)) {
+                ok = false;
+                break;
+            }
+            int pixelsLength = readU32(p);
+            pixels(p + 4, pixelsLength);
+            p += 4 + pixelsLength;
+        }
+        else
+            ok = false;
+    }
+
+    free(attr);
+    return ok;
+}
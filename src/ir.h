@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+
+// Pre-parsed pool (IR file). The XML is tokenized offline into a list
+// of element records, and the Base64 image data is decoded, so that a
+// pool can be generated for the connected VT without running the XML
+// parser. The records are replayed into the same start() and end()
+// functions as the XML, so the result is identical.
+//
+// The file starts with IrHeader, followed by a string table of NUL
+// terminated element names, attribute names and values (each stored
+// once) and the records:
+//   IR_START  u32 name, u16 count, count * (u32 name, u32 value)
+//   IR_END    u32 name
+//   IR_PIXELS u32 length, length bytes of decoded image data
+// Strings are given as offsets in the string table. All numbers are
+// little endian and not aligned. The string table is used in place,
+// so the file can be mapped to memory as such.
+
+#define IR_MAGIC 0x58504550  // "PEPX"
+#define IR_VERSION 1
+
+#define IR_START 1
+#define IR_END 2
+#define IR_PIXELS 3
+
+typedef struct
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int stringsOffset;
+    unsigned int stringsSize;
+    unsigned int recordsOffset;
+    unsigned int recordsSize;
+} IrHeader;
+
+// converts the XML file to an IR file, returns false on error
+int compile_ir(FILE *xml, FILE *out);
+
+// converts the XML file to IR in memory, so that it can be given to
+// parse_ir() once for every VT. Returns NULL on error, free the IR
+// with free().
+unsigned char *compile_ir_buffer(FILE *xml, int *length);
+
+// maps an IR file to memory (reads it, if mmap() is not available).
+// Returns NULL if file is not an IR file.
+const unsigned char *open_ir(FILE *file, int *length);
+void close_ir(const unsigned char *ir, int length);
+
+// calls start() and end() for the element records and pixels() for
+// decoded image data, returns false if the IR is corrupt
+int replayIr(const unsigned char *ir, int length,
+             void (*start)(void *data, const char *el, const char **attr),
+             void (*end)(void *data, const char *el),
+             void (*pixels)(const unsigned char *data, int length));
+
+#endif
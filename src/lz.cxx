@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+
+// look lz.h for function definitions
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// hash of the 4 bytes at p
+unsigned int lzHash(const unsigned char *p)
+{
+    unsigned int value;
+    memcpy(&value, p, 4);
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the extra bytes of a length that didn't fit in the token
+unsigned char *writeLength(unsigned char *dst, int length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+        *dst++ = 255;
+    *dst++ = length;
+    return dst;
+}
+
+// writes a sequence of literals and a match, match length 0 ends the
+// data
+unsigned char *writeSequence(unsigned char *dst, const unsigned char *literals, int nroLiterals,
+                             int offset, int matchLength)
+{
+    unsigned char *token = dst++;
+    int extra = matchLength - LZ_MIN_MATCH;
+    *token = (nroLiterals < 15 ? nroLiterals : 15) << 4;
+    if (nroLiterals >= 15)
+        dst = writeLength(dst, nroLiterals);
+    memcpy(dst, literals, nroLiterals);
+    dst += nroLiterals;
+    if (matchLength == 0)
+        return dst;
+
+    *token |= (extra < 15) ? extra : 15;
+    *dst++ = offset & 0xFF;
+    *dst++ = offset >> 8;
+    if (extra >= 15)
+        dst = writeLength(dst, extra);
+    return dst;
+}
+
+int lzCompress(const unsigned char *src, int length, unsigned char *dst)
+{
+    int table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    unsigned char *out = dst;
+    int anchor = 0;
+    int i = 0;
+    while (i + LZ_MIN_MATCH <= length) {
+        unsigned int hash = lzHash(src + i);
+        int candidate = table[hash];
+        table[hash] = i;
+        if (candidate < 0 || i - candidate > LZ_MAX_OFFSET
+            || memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+
+        int matchLength = LZ_MIN_MATCH;
+        while (i + matchLength < length && src[candidate + matchLength] == src[i + matchLength])
+            matchLength++;
+        out = writeSequence(out, src + anchor, i - anchor, i - candidate, matchLength);
+        i += matchLength;
+        anchor = i;
+    }
+    out = writeSequence(out, src + anchor, length - anchor, 0, 0);
+    return out - dst;
+}
+
+// reads the extra bytes of a length, returns -1 at the end of data
+int readLength(const unsigned char **src, const unsigned char *end, int length)
+{
+    if (length < 15)
+        return length;
+    for (;;) {
+        if (*src >= end)
+            return -1;
+        int byte = *(*src)++;
+        length += byte;
+        if (byte < 255)
+            return length;
+    }
+}
+
+int lzDecompress(const unsigned char *src, int length, unsigned char *dst, int capacity)
+{
+    const unsigned char *end = src + length;
+    unsigned char *out = dst;
+    unsigned char *outEnd = dst + capacity;
+
+    while (src < end) {
+        int token = *src++;
+        int nroLiterals = readLength(&src, end, token >> 4);
+        if (nroLiterals < 0 || nroLiterals > end - src || nroLiterals > outEnd - out)
+            return -1;
+        memcpy(out, src, nroLiterals);
+        out += nroLiterals;
+        src += nroLiterals;
+        if (src == end)
+            break;
+
+        if (end - src < 2)
+            return -1;
+        int offset = src[0] | (src[1] << 8);
+        src += 2;
+        int matchLength = readLength(&src, end, token & 15);
+        if (matchLength < 0 || offset == 0 || offset > out - dst)
+            return -1;
+        matchLength += LZ_MIN_MATCH;
+        if (matchLength > outEnd - out)
+            return -1;
+
+        const unsigned char *match = out - offset;
+        if (offset >= matchLength)
+            memcpy(out, match, matchLength);
+        else
+            for (int i = 0; i < matchLength; i++)
+                out[i] = match[i];
+        out += matchLength;
+    }
+    return out - dst;
+}
+
+////////// compressed pool //////////
+
+typedef struct
+{
+    pool_sink_t sink;     // must be first
+    pool_sink_t *next;
+    unsigned char *buffer;
+    int capacity;
+    pool_span_t *frames;
+    int nroFrames;
+} CompressSink;
+
+// writes a LEB128 number
+unsigned char *writeNumber(unsigned char *dst, unsigned int value)
+{
+    while (value >= 0x80) {
+        *dst++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *dst++ = value;
+    return dst;
+}
+
+// reads a LEB128 number, returns -1 at the end of data
+int readNumber(const unsigned char **src, const unsigned char *end)
+{
+    unsigned int value = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (*src >= end)
+            return -1;
+        int byte = *(*src)++;
+        value |= (unsigned int) (byte & 0x7F) << shift;
+        if (byte < 0x80)
+            return (value > 0x7FFFFFFF) ? -1 : (int) value;
+    }
+    return -1;
+}
+
+// passes spans to next sink and updates its totals
+void writeNext(pool_sink_t *next, const pool_span_t *spans, int count)
+{
+    for (int i = 0; i < count; i++)
+        next->size += spans[i].length;
+    next->objects += count;
+    next->write(next, spans, count);
+}
+
+void compressSinkWrite(pool_sink_t *sink, const pool_span_t *spans, int count)
+{
+    CompressSink *c = (CompressSink *) sink;
+
+    // room for the frames of the whole batch
+    int needed = 0;
+    for (int i = 0; i < count; i++)
+        needed += 12 + LZ_BOUND(spans[i].length);
+    if (needed > c->capacity) {
+        c->capacity = needed;
+        c->buffer = (unsigned char *) realloc(c->buffer, needed);
+    }
+    if (count > c->nroFrames) {
+        c->nroFrames = count;
+        c->frames = (pool_span_t *) realloc(c->frames, count * sizeof(pool_span_t));
+    }
+    if (c->buffer == NULL || c->frames == NULL) {
+        printf("out of memory!\n");
+        exit(-1);
+    }
+
+    unsigned char *out = c->buffer;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data = (const unsigned char *) spans[i].data;
+        int length = spans[i].length;
+        unsigned char *frame = out;
+
+        // compress after room for the frame header, the header is
+        // moved in front of the data afterwards
+        unsigned char *packed = out + 12;
+        int packedLength = lzCompress(data, length, packed);
+        *out++ = (length >= 1) ? data[0] : 0xFF;
+        *out++ = (length >= 2) ? data[1] : 0xFF;
+        out = writeNumber(out, length);
+        if (packedLength < length) {
+            out = writeNumber(out, packedLength);
+            memmove(out, packed, packedLength);
+            out += packedLength;
+        }
+        else {
+            out = writeNumber(out, 0);
+            memcpy(out, data, length);
+            out += length;
+        }
+        c->frames[i].data = (const char *) frame;
+        c->frames[i].length = out - frame;
+    }
+    writeNext(c->next, c->frames, count);
+}
+
+pool_sink_t *open_compress_sink(pool_sink_t *next)
+{
+    CompressSink *c = (CompressSink *) calloc(1, sizeof(CompressSink));
+    c->next = next;
+    c->sink.write = compressSinkWrite;
+
+    unsigned char header[8];
+    unsigned int magic = LZ_POOL_MAGIC;
+    unsigned int version = LZ_POOL_VERSION;
+    memcpy(header, &magic, 4);
+    memcpy(header + 4, &version, 4);
+    pool_span_t span;
+    span.data = (const char *) header;
+    span.length = sizeof(header);
+    next->write(next, &span, 1);
+    next->size += sizeof(header);
+    return &c->sink;
+}
+
+void close_compress_sink(pool_sink_t *sink)
+{
+    CompressSink *c = (CompressSink *) sink;
+    free(c->buffer);
+    free(c->frames);
+    free(c);
+}
+
+// reads a frame header, returns false at the end of data or if the
+// header is corrupt
+int readFrame(const unsigned char **src, const unsigned char *end,
+              int *objectId, int *length, int *packedLength)
+{
+    if (end - *src < 2)
+        return false;
+    *objectId = (*src)[0] | ((*src)[1] << 8);
+    *src += 2;
+    *length = readNumber(src, end);
+    *packedLength = readNumber(src, end);
+    int stored = (*packedLength == 0) ? *length : *packedLength;
+    return *length >= 0 && *packedLength >= 0 && stored <= end - *src;
+}
+
+// checks the file header, returns the first frame or NULL
+const unsigned char *firstFrame(const unsigned char *data, int length)
+{
+    unsigned int magic;
+    unsigned int version;
+    if (length < 8)
+        return NULL;
+    memcpy(&magic, data, 4);
+    memcpy(&version, data + 4, 4);
+    if (magic != LZ_POOL_MAGIC || version != LZ_POOL_VERSION)
+        return NULL;
+    return data + 8;
+}
+
+int unpack_pool(const unsigned char *data, int length, void (*ready)(char *data, int length))
+{
+    const unsigned char *src = firstFrame(data, length);
+    const unsigned char *end = data + length;
+    unsigned char *buffer = NULL;
+    int capacity = 0;
+    int size = 0;
+
+    if (src == NULL)
+        return -1;
+    while (src < end) {
+        int objectId, objectLength, packedLength;
+        if (!readFrame(&src, end, &objectId, &objectLength, &packedLength)) {
+            size = -1;
+            break;
+        }
+        if (packedLength == 0) {
+            ready((char *) src, objectLength);
+            src += objectLength;
+        }
+        else {
+            if (objectLength > capacity) {
+                capacity = objectLength;
+                buffer = (unsigned char *) realloc(buffer, capacity);
+            }
+            if (lzDecompress(src, packedLength, buffer, objectLength) != objectLength) {
+                size = -1;
+                break;
+            }
+            ready((char *) buffer, objectLength);
+            src += packedLength;
+        }
+        size += objectLength;
+    }
+    free(buffer);
+    return size;
+}
+
+int unpack_object(const unsigned char *data, int length, int objectId,
+                  unsigned char *dst, int capacity)
+{
+    const unsigned char *src = firstFrame(data, length);
+    const unsigned char *end = data + length;
+    if (src == NULL)
+        return -1;
+
+    // skip the other frames without decompressing them
+    while (src < end) {
+        int id, objectLength, packedLength;
+        if (!readFrame(&src, end, &id, &objectLength, &packedLength))
+            return -1;
+        int stored = (packedLength == 0) ? objectLength : packedLength;
+        if (id != objectId) {
+            src += stored;
+            continue;
+        }
+        if (objectLength > capacity)
+            return -1;
+        if (packedLength == 0) {
+            memcpy(dst, src, objectLength);
+            return objectLength;
+        }
+        return (lzDecompress(src, packedLength, dst, objectLength) == objectLength) ? objectLength : -1;
+    }
+    return -1;
+}
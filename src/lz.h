@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include "parser.h"
+
+// Fast LZ77 codec in the style of LZ4. The compressed data is a list
+// of sequences: a token byte with the number of literals in the high
+// and the match length - 4 in the low nibble (15 means that more
+// length bytes follow, each adding up to 255), the literals, and for
+// every sequence but the last one a 2 byte little endian offset back
+// to the match and the extra match length bytes.
+
+// maximum size of compressed data for length bytes of input
+#define LZ_BOUND(length) ((length) + (length) / 255 + 16)
+
+// compresses length bytes of src to dst, which must have room for
+// LZ_BOUND(length) bytes. Returns the compressed size.
+int lzCompress(const unsigned char *src, int length, unsigned char *dst);
+
+// decompresses src to dst, returns the decompressed size or -1 if the
+// data is corrupt or doesn't fit in capacity bytes
+int lzDecompress(const unsigned char *src, int length, unsigned char *dst, int capacity);
+
+// Compressed pool file: magic and version, followed by one frame per
+// object in pool order. A frame is the 2 byte object id, the object
+// size and the compressed size as LEB128 numbers, and the compressed
+// object. Compressed size 0 means that the object is stored as is.
+// Frames can be skipped without decompressing them.
+
+#define LZ_POOL_MAGIC 0x5a504550  // "PEPZ"
+#define LZ_POOL_VERSION 1
+
+// creates a sink that compresses every object and passes the frames
+// to next. size and objects of next count the compressed bytes and
+// the frames.
+pool_sink_t *open_compress_sink(pool_sink_t *next);
+void close_compress_sink(pool_sink_t *sink);
+
+// decompresses a compressed pool and passes the objects to ready() one
+// at a time, so that they can be streamed to the VT without the whole
+// pool in memory. Returns the pool size, or -1 if the data is corrupt.
+int unpack_pool(const unsigned char *data, int length, void (*ready)(char *data, int length));
+
+// decompresses the first object with given id to dst, returns its size
+// or -1 if it is not found or doesn't fit in capacity bytes
+int unpack_object(const unsigned char *data, int length, int objectId,
+                  unsigned char *dst, int capacity);
+
+#endif
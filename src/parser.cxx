@@ -27,6 +27,10 @@
 
 #include "xml.h"
 #include "parser.h"
+#include "cache.h"
+#include "ir.h"
+#include "picture.h"
+#include "pool.h"
 #include "../include/expat.h"
 #include "parserdef.h"
 
@@ -57,7 +61,64 @@ int dataReading = 0;   // tells if now reading data
 char *dataText = NULL;
 int dataLength =0;
 
+// pictureData that was already decoded (see ir.h)
+const unsigned char *pixelData = NULL;
+int pixelDataLength = 0;
+
+// directory for cached picture data, NULL if not in use
+const char *pictureCacheDir = NULL;
+
+// pool size budget, 0 if not in use
+int maxPoolSize = 0;
+
+// string value of an object in one language
+typedef struct
+{
+    int objectId;
+    char code[3];
+    int length;
+    unsigned char *value;
+} Translation;
+
+#define MAX_LANGUAGES 64
+
+int multiLanguage = 0;
+int segmentMode = 0;
+int *segmentOf = NULL;
+int *segmentOfId = NULL;
+int nroSegments = 0;
+int deduplicate = 0;
+int prune = 0;
+int optimizeMacroCommands = 0;
+int renumberBase = -1;
+void (*remapFunct)(const int *newIds) = NULL;
+const unsigned char *(*fragmentFunct)(const char *file, int *size) = NULL;
+
+// where the object ids of the pool come from: 0 if an id is not used,
+// SOURCE_DOCUMENT for the objects of the input, and 1, 2, ... for the
+// fragments in the order they are included. The file names of the
+// fragments are in includedFiles.
+#define SOURCE_DOCUMENT -1
+short idSource[NRO_IDS];
+char **includedFiles = NULL;
+int nroIncludes = 0;
+int inFragment = 0;
+char languages[MAX_LANGUAGES][3];
+int nroLanguages = 0;
+Translation *translations = NULL;
+int nroTranslations = 0;
+
+pool_stats_t stats;
+
 void (*readyFunct)(char *data, int length);
+
+// objects waiting to be passed to the output sink, and the patched
+// copies that are freed after that
+#define SINK_BATCH 256
+pool_sink_t *outputSink = NULL;
+pool_span_t batch[SINK_BATCH];
+char *batchCopies[SINK_BATCH];
+int batchCount = 0;
 void (*startFunct)(void *data, char *el, const char ** attr);
 void (*endFunct)(void *data, char *el);
 
@@ -66,6 +127,96 @@ pool_xform_t *get_pool_xform()
     return &xform;
 }
 
+pool_stats_t *get_pool_stats()
+{
+    return &stats;
+}
+
+void set_picture_cache(const char *dir)
+{
+    pictureCacheDir = dir;
+}
+
+void set_max_pool_size(int bytes)
+{
+    maxPoolSize = bytes;
+}
+
+void set_multi_language(int enable)
+{
+    multiLanguage = enable;
+}
+
+void set_segments(int enable)
+{
+    segmentMode = enable;
+}
+
+int get_segment_count()
+{
+    return nroSegments;
+}
+
+int get_segment_of(int object_id)
+{
+    if (segmentOfId == NULL || object_id < 0 || object_id >= NRO_IDS)
+        return -1;
+    return segmentOfId[object_id];
+}
+
+void set_output_sink(pool_sink_t *sink)
+{
+    outputSink = sink;
+}
+
+void set_deduplicate(int enable)
+{
+    deduplicate = enable;
+}
+
+void set_prune(int enable)
+{
+    prune = enable;
+}
+
+void set_optimize_macros(int enable)
+{
+    optimizeMacroCommands = enable;
+}
+
+void set_renumber(int base)
+{
+    renumberBase = base;
+}
+
+void set_fragment_function(const unsigned char *(*fragment)(const char *file, int *size))
+{
+    fragmentFunct = fragment;
+}
+
+void set_remap_function(void (*remap)(const int *new_ids))
+{
+    remapFunct = remap;
+}
+
+int get_language_count()
+{
+    return nroLanguages;
+}
+
+const char *get_language_code(int index)
+{
+    return languages[index];
+}
+
+// returns true if the whole pool must be collected before it is
+// passed to the main program
+int collectObjects()
+{
+    return maxPoolSize > 0 || multiLanguage || segmentMode || deduplicate || prune
+        || optimizeMacroCommands || renumberBase >= 0;
+}
+
 // returns the type of object
 int getObjectType(void *object)
 {
@@ -595,38 +746,53 @@ void addPictureData(void **object)
     }
     PictureGraphic *picture = (PictureGraphic *) *object;
     int size = picture->actualWidth * picture->actualHeight;
-    if (size != getDataLength(dataLength)) {
+    int givenSize = pixelData ? pixelDataLength : getDataLength(dataLength);
+    if (size != givenSize) {
         printf("ERROR. Data length miss match (size = %i, size2 = %i)\n",
-               size, getDataLength(dataLength));
+               size, givenSize);
         return;
     }
-    unsigned char *data = convertFromBase64(dataText, size);
-    unsigned char *reducedData = data;
-
-    // reduce colors and rearrenge data
-    if (vtColors == 16) {
-        int dataWidth = (picture->actualWidth + 1) / 2;
-        reducedData = (unsigned char *) calloc(dataWidth * picture->actualHeight, sizeof(char));
 
-        for (int y = 0; y < picture->actualHeight; y++)
-            for (int x = 0; x < picture->actualWidth; x += 2)
-                for (int i = 0; (i < 2) && ((x + i) < picture->actualWidth); i++)
-                    reducedData[y * dataWidth + x / 2] += (reduceColor(data[y * picture->actualWidth + x + i], vtColors) << (1 - i) * 4);
-
-        size = dataWidth * picture->actualHeight;
-        free(data);
-        data = reducedData;
+    // the converted data depends only on the base64 payload, the
+    // image size and the color depth (and scaling, if pictures are
+    // ever scaled), so a cached copy can be used as such
+    unsigned long long key = 0;
+    if (pictureCacheDir != NULL) {
+        if (pixelData)
+            key = hashBytes(pixelData, pixelDataLength, HASH_SEED);
+        else
+            key = hashBytes(dataText, dataLength, HASH_SEED);
+        key = hashInt(picture->actualWidth, key);
+        key = hashInt(picture->actualHeight, key);
+        key = hashInt(vtColors, key);
+        key = hashBytes(&multiplier, sizeof(multiplier), key);
+
+        int cachedSize;
+        FILE *file = cacheOpen(pictureCacheDir, "pic", key, &cachedSize);
+        if (file != NULL) {
+            picture->rawDataLength = cachedSize;
+            *object = realloc(*object, getRealSize(*object));
+            int ok = fread(((char *) *object) + sizeof(PictureGraphic), 1, cachedSize, file) == (size_t) cachedSize;
+            fclose(file);
+            if (ok) {
+                stats.picture_cache_hits++;
+                return;
+            }
+        }
+        stats.picture_cache_misses++;
     }
-    else if (vtColors == 2) {
-        int dataWidth = (picture->actualWidth + 7) / 8;
-        reducedData = (unsigned char *) calloc(dataWidth * picture->actualHeight, sizeof(char));
 
-        for (int y = 0; y < picture->actualHeight; y++)
-            for (int x = 0; x < picture->actualWidth; x += 8)
-                for (int i = 0; (i < 8) && ((x + i) < picture->actualWidth); i++)
-                    reducedData[y * dataWidth + x / 8] += (reduceColor(data[y * picture->actualWidth + x + i], vtColors) << (7 - i));
+    unsigned char *data;
+    if (pixelData) {
+        data = (unsigned char *) malloc(size);
+        memcpy(data, pixelData, size);
+    }
+    else
+        data = convertFromBase64(dataText, size);
 
-        size = dataWidth * picture->actualHeight;
+    // reduce colors and rearrenge data
+    if (vtColors != 256) {
+        unsigned char *reducedData = packPicture(data, picture->actualWidth, picture->actualHeight, vtColors, &size);
         free(data);
         data = reducedData;
     }
@@ -642,6 +808,9 @@ void addPictureData(void **object)
     // copy data
     memmove(( ((char *) *object) + sizeof(PictureGraphic)), data, size);
 
+    if (pictureCacheDir != NULL && cacheStore(pictureCacheDir, "pic", key, data, size) != 0)
+        printf("WARNING: can't write picture cache in %s\n", pictureCacheDir);
+
     free(data);
 }
 
@@ -738,9 +907,7 @@ void *createObject(int type, const char **attr){
             inputString->length = getLength(attr);
 
             // copy string
-            char *string = getValueString(attr, getLength(attr));
-            memcpy( inputString->value, string, getLength(attr) );
-            free( string );
+            copyValueString(attr, inputString->value, inputString->length);
 
             *inputStringEnabled(inputString) = isEnabled(attr);
             return inputString;
@@ -791,9 +958,7 @@ void *createObject(int type, const char **attr){
             outputString->length = getLength(attr);
 
             // copy string
-            char *string = getValueString(attr, getLength(attr));
-            memcpy(outputString->value, string, getLength(attr));
-            free(string);
+            copyValueString(attr, outputString->value, outputString->length);
 
             return outputString;
         }
@@ -939,9 +1104,7 @@ void *createObject(int type, const char **attr){
             stringVariable->length = getLength(attr);
 
             // copy string
-            char *string = getValueString(attr, getLength(attr));
-            memcpy(( ((char *) stringVariable) + 5), string, getLength(attr));
-            free(string);
+            copyValueString(attr, ((unsigned char *) stringVariable) + sizeof(StringVariable), stringVariable->length);
             return stringVariable;
         }
     case 23: // FontAttributes
@@ -980,9 +1143,7 @@ void *createObject(int type, const char **attr){
             inputAttributes->length = getLength(attr);
 
             // copy string
-            char *string = getValidatioinString(attr, getLength(attr));
-            memcpy(inputAttributes->validationString, string, getLength(attr));
-            free(string);
+            copyValidationString(attr, inputAttributes->validationString, inputAttributes->length);
             return inputAttributes;
         }
     case 27: // ObjectPointer
@@ -1149,9 +1310,7 @@ void *createCommand(int command, const char **attr)
             changeStringValue->objectId = getObjectId(attr);
             changeStringValue->length = length;
 
-            char *string = getValueString(attr, length);
-            memmove(changeStringValue->string, string, length);
-            free(string);
+            copyValueString(attr, changeStringValue->string, length);
             return changeStringValue;
         }
     case 169:
@@ -1372,15 +1531,274 @@ void addEventReference(void **object, MacroReference macroRef)
     }
     *object = realloc(*object, getRealSize(*object));
 
+    // language codes of a working set come after the macros
+    int index = orginalSize;
+    if (objectType == 0) {
+        index -= ((WorkingSet *) *object)->languageCodes * sizeof(LanguageCode);
+        memmove(((char *) *object) + index + sizeof(MacroReference), ((char *) *object) + index, orginalSize - index);
+    }
+
     // copy reference
-    memmove(((char *) *object) + orginalSize, &macroRef, sizeof(MacroReference));
+    memmove(((char *) *object) + index, &macroRef, sizeof(MacroReference));
+}
+
+// returns a pointer to the value of a string object (and sets its
+// length), or NULL if object has no string value
+unsigned char *getStringValue(void *object, int *length)
+{
+    switch (getObjectType(object)) {
+    case 8:
+        *length = ((InputString *) object)->length;
+        return ((InputString *) object)->value;
+    case 11:
+        *length = ((OutputString *) object)->length;
+        return ((OutputString *) object)->value;
+    case 22:
+        *length = ((StringVariable *) object)->length;
+        return ((unsigned char *) object) + sizeof(StringVariable);
+    }
+    return NULL;
+}
+
+// adds a language code to the list of known languages
+void addLanguageCode(const char *code)
+{
+    for (int i = 0; i < nroLanguages; i++)
+        if (strncmp(languages[i], code, 2) == 0)
+            return;
+
+    if (nroLanguages == MAX_LANGUAGES) {
+        printf("ERROR: too many languages!\n");
+        return;
+    }
+    languages[nroLanguages][0] = code[0];
+    languages[nroLanguages][1] = code[1];
+    languages[nroLanguages][2] = 0;
+    nroLanguages++;
+}
+
+// handles a language element: adds a language code to a working set,
+// or a string value in one language to a string object. The codes are
+// only put in the working set in multi-language mode, so that the
+// default pool stays as it was.
+void addLanguage(void **object, const char **attr)
+{
+    char *code = getLanguageCode(attr);
+    if (code == NULL) {
+        printf("ERROR: language element without code!\n");
+        return;
+    }
+    addLanguageCode(code);
+
+    int objectType = getObjectType(*object);
+    if (objectType == 0) {
+        if (!multiLanguage)
+            return;
+        int orginalSize = getRealSize(*object);
+        ((WorkingSet *) *object)->languageCodes++;
+        *object = realloc(*object, getRealSize(*object));
+
+        LanguageCode languageCode;
+        languageCode.char1 = code[0];
+        languageCode.char2 = code[1];
+        memmove(((char *) *object) + orginalSize, &languageCode, sizeof(LanguageCode));
+        return;
+    }
+
+    int length;
+    if (getStringValue(*object, &length) == NULL || getAttribute(attr, "value") == NULL) {
+        printf("ERROR. Object %i (Id=%i) can't have a language value!\n",
+               objectType, getObjectId(*object));
+        return;
+    }
+
+    translations = (Translation *) realloc(translations, (nroTranslations + 1) * sizeof(Translation));
+    Translation *translation = &translations[nroTranslations++];
+    translation->objectId = getObjectId(*object);
+    translation->code[0] = code[0];
+    translation->code[1] = code[1];
+    translation->code[2] = 0;
+    translation->length = length;
+    translation->value = (unsigned char *) malloc(length + 1);
+    copyValueString(attr, translation->value, length);
+}
+
+// returns the string value of given object in given language, or
+// NULL if there is none
+Translation *findTranslation(int objectId, const char *language)
+{
+    for (int i = 0; i < nroTranslations; i++)
+        if (translations[i].objectId == objectId && strncmp(translations[i].code, language, 2) == 0)
+            return &translations[i];
+    return NULL;
+}
+
+// called after a pool pass has changed object ids, keeps the string
+// values of languages in sync and informs the main program. The
+// string values of removed objects are dropped.
+void poolRemapped(const int *newIds)
+{
+    int count = 0;
+    for (int i = 0; i < nroTranslations; i++) {
+        int id = newIds[translations[i].objectId];
+        if (id < 0) {
+            free(translations[i].value);
+            continue;
+        }
+        translations[count] = translations[i];
+        translations[count++].objectId = id;
+    }
+    nroTranslations = count;
+
+    if (remapFunct != NULL)
+        remapFunct(newIds);
+}
+
+// passes the waiting objects to the output sink
+void flushBatch()
+{
+    if (batchCount == 0)
+        return;
+    outputSink->write(outputSink, batch, batchCount);
+    for (int i = 0; i < batchCount; i++)
+        free(batchCopies[i]);
+    batchCount = 0;
+}
+
+// passes an object to the output sink or to ready(). If copy is true,
+// data is freed after it has been written.
+void emitObject(void (*ready)(char *data, int length), char *data, int length, int copy)
+{
+    if (outputSink == NULL) {
+        ready(data, length);
+        if (copy)
+            free(data);
+        return;
+    }
+    batch[batchCount].data = data;
+    batch[batchCount].length = length;
+    batchCopies[batchCount++] = copy ? data : NULL;
+    outputSink->size += length;
+    outputSink->objects++;
+    if (batchCount == SINK_BATCH)
+        flushBatch();
+}
+
+// passes the objects of one segment (all if segment is negative) to
+// the output, with the string values of given language
+void emitObjects(int segment, const char *language, void (*ready)(char *data, int length))
+{
+    for (int i = 0; i < nroPoolObjects; i++) {
+        void *object = poolObjects[i];
+        if (segment >= 0 && segmentOf[i] != segment)
+            continue;
+        int size = getRealSize(object);
+        int length;
+        unsigned char *value = getStringValue(object, &length);
+        Translation *translation = (value && language) ? findTranslation(getObjectId(object), language) : NULL;
+
+        if (translation == NULL) {
+            emitObject(ready, (char *) object, size, false);
+            continue;
+        }
+
+        // patch a copy, the pool is shared by all languages
+        char *copy = (char *) malloc(size);
+        memcpy(copy, object, size);
+        memcpy(copy + (value - (unsigned char *) object), translation->value,
+               (translation->length < length) ? translation->length : length);
+        emitObject(ready, copy, size, true);
+    }
+    if (outputSink != NULL)
+        flushBatch();
+}
+
+void emit_pool(const char *language, void (*ready)(char *data, int length))
+{
+    emitObjects(-1, language, ready);
+}
+
+void emit_segment(int segment, const char *language, void (*ready)(char *data, int length))
+{
+    emitObjects(segment, language, ready);
+}
+
+void free_pool()
+{
+    poolClear();
+    free(segmentOf);
+    segmentOf = NULL;
+    free(segmentOfId);
+    segmentOfId = NULL;
+    nroSegments = 0;
+    for (int i = 0; i < nroTranslations; i++)
+        free(translations[i].value);
+    free(translations);
+    translations = NULL;
+    nroTranslations = 0;
+}
+
+// records that an object id is used by given source. The same id in
+// the document and a fragment, or in two fragments, is an error.
+void claimObjectId(int objectId, int source)
+{
+    int owner = idSource[objectId];
+    if (owner != 0 && owner != source) {
+        if (owner == SOURCE_DOCUMENT || source == SOURCE_DOCUMENT)
+            printf("ERROR: object id %d is used by the document and by fragment %s\n",
+                   objectId, includedFiles[(owner > source ? owner : source) - 1]);
+        else
+            printf("ERROR: object id %d is used by fragments %s and %s\n",
+                   objectId, includedFiles[owner - 1], includedFiles[source - 1]);
+        exit(-1);
+    }
+    idSource[objectId] = source;
 }
 
 // when object is read, main program is informed and memory released
 void objectReady(void *object) {
-    int size = getRealSize(object);
-    readyFunct((char *) object, size);
-    free(object);
+    claimObjectId(((ObjectHeader *) object)->objectId, SOURCE_DOCUMENT);
+    if (collectObjects()) {
+        poolAdd(object);
+        return;
+    }
+    emitObject(readyFunct, (char *) object, getRealSize(object), true);
+}
+
+// puts the objects of a compiled fragment to the pool. They are
+// scaled already and are linked to the output as they are.
+void includeFragment(const char *file)
+{
+    if (inFragment) {
+        printf("ERROR: a fragment can't include another fragment: %s\n", file ? file : "");
+        exit(-1);
+    }
+
+    int size = 0;
+    const unsigned char *data = NULL;
+    if (file != NULL && fragmentFunct != NULL)
+        data = fragmentFunct(file, &size);
+    if (data == NULL) {
+        printf("ERROR: fragment not found: %s\n", file ? file : "");
+        exit(-1);
+    }
+
+    includedFiles = (char **) realloc(includedFiles, (nroIncludes + 1) * sizeof(char *));
+    includedFiles[nroIncludes++] = strdup(file);
+
+    for (int offset = 0; offset < size; ) {
+        char *object = (char *) data + offset;
+        int length = getRealSize(object);
+        claimObjectId(((ObjectHeader *) object)->objectId, nroIncludes);
+        if (collectObjects()) {
+            char *copy = (char *) malloc(length);
+            memcpy(copy, object, length);
+            poolAdd(copy);
+        }
+        else
+            emitObject(readyFunct, object, length, false);
+        offset += length;
+    }
 }
 
 float min(float a, float b) {
@@ -1478,8 +1896,8 @@ void start(void *data, const char *el, const char **attr) {
         pictureGraphic->actualHeight = getActualHeight(attr);
         dataReading = 1;
     }
-    else if (strcmp(el, "language") == 0) {
-        // FIXME not implemented yet
+    else if ((strcmp(el, "language") == 0) && (objectsInStack > 0)) {
+        addLanguage(&objectStack[objectsInStack - 1], attr);
     }
 
     // if elment is a command, add it to a macro
@@ -1489,6 +1907,9 @@ void start(void *data, const char *el, const char **attr) {
         addCommand(&objectStack[objectsInStack - 1], comm);
         free(comm);
     }
+    else if ((strcmp(el, "include_fragment") == 0) && (objectsInStack == 0)) {
+        includeFragment(getAttribute(attr, "file"));
+    }
     else if (objectsInStack == 0) {
     }
     else {
@@ -1515,6 +1936,8 @@ void end(void *data, const char *el) {
         free(dataText);
         dataText = NULL;
         dataLength = 0;
+        pixelData = NULL;
+        pixelDataLength = 0;
     }
     int type = -1;
     for (int i = 0; i <= 32; i++)
@@ -1543,15 +1966,10 @@ void characterDataHandler(void *userData, const XML_Char *s, int len)
     }
 }
 
-// Fuction parses a .xml file that is imported from PoolEdit program.
-// - start() and end() functions are called when a new element is
-//   started or ended.
-// - ready() is called when parsing is done, and an array with
-//   ISOBUS data is returned parameters vtDimension_, vtSkWidth_,
-//   vtSkHeight_ and vtColors_ give info about VT
-void parse(FILE *file, void (*start_)(void *data, char *el, const char **attr),
-           void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
-           int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_)
+// sets up the parser state before the elements are read
+void beginParse(void (*start_)(void *data, char *el, const char **attr),
+                void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+                int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_)
 {
     readyFunct = ready;
     startFunct = start_;
@@ -1562,6 +1980,79 @@ void parse(FILE *file, void (*start_)(void *data, char *el, const char **attr),
     vtColors = vtColors_;
 
     objectsInStack = 0;
+    nroLanguages = 0;
+    memset(idSource, 0, sizeof(idSource));
+    for (int i = 0; i < nroIncludes; i++)
+        free(includedFiles[i]);
+    nroIncludes = 0;
+    free_pool();
+    free(stats.degraded);
+    free(stats.removed);
+    memset(&stats, 0, sizeof(stats));
+}
+
+// runs the whole pool options after all elements have been read
+void finishParse()
+{
+    if (outputSink != NULL)
+        flushBatch();
+
+    if (collectObjects()) {
+        int *newIds = (int *) malloc(NRO_IDS * sizeof(int));
+        if (prune) {
+            prunePool(&stats, newIds);
+            poolRemapped(newIds);
+        }
+        if (optimizeMacroCommands) {
+            optimizeMacros(&stats, newIds);
+            poolRemapped(newIds);
+        }
+        if (deduplicate) {
+            deduplicatePool(&stats, newIds);
+            poolRemapped(newIds);
+        }
+        if (renumberBase >= 0) {
+            if (renumberPool(renumberBase, newIds) >= 0)
+                poolRemapped(newIds);
+            else
+                stats.renumber_failed = 1;
+        }
+        free(newIds);
+
+        if (maxPoolSize > 0)
+            fitPool(maxPoolSize, &stats);
+
+        if (segmentMode) {
+            segmentOf = (int *) malloc((nroPoolObjects + 1) * sizeof(int));
+            nroSegments = segmentPool(segmentOf);
+            // the manifest looks up the segment of every name
+            segmentOfId = (int *) malloc(NRO_IDS * sizeof(int));
+            for (int i = 0; i < NRO_IDS; i++)
+                segmentOfId[i] = -1;
+            for (int i = nroPoolObjects - 1; i >= 0; i--)
+                segmentOfId[((ObjectHeader *) poolObjects[i])->objectId] = segmentOf[i];
+        }
+
+        // in multi-language and segment modes main program calls
+        // emit_pool() or emit_segment()
+        if (!multiLanguage && !segmentMode) {
+            emitObjects(-1, NULL, readyFunct);
+            free_pool();
+        }
+    }
+}
+
+// Fuction parses a .xml file that is imported from PoolEdit program.
+// - start() and end() functions are called when a new element is
+//   started or ended.
+// - ready() is called when parsing is done, and an array with
+//   ISOBUS data is returned parameters vtDimension_, vtSkWidth_,
+//   vtSkHeight_ and vtColors_ give info about VT
+void parse(FILE *file, void (*start_)(void *data, char *el, const char **attr),
+           void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+           int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_)
+{
+    beginParse(start_, end_, ready, vtDimension_, vtSkWidth_, vtSkHeight_, vtColors_);
 
     XML_Parser p = XML_ParserCreate(NULL);
     XML_SetElementHandler(p, start, end);
@@ -1589,4 +2080,58 @@ void parse(FILE *file, void (*start_)(void *data, char *el, const char **attr),
         }
     }
     XML_ParserFree(p);
+
+    finishParse();
+}
+
+// the decoded image data of the next image_data element
+void irPixels(const unsigned char *pixels, int length)
+{
+    pixelData = pixels;
+    pixelDataLength = length;
+}
+
+void parse_ir(const unsigned char *ir, int length,
+              void (*start_)(void *data, char *el, const char **attr),
+              void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+              int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_)
+{
+    beginParse(start_, end_, ready, vtDimension_, vtSkWidth_, vtSkHeight_, vtColors_);
+    if (!replayIr(ir, length, start, end, irPixels)) {
+        fprintf(stderr, "Corrupt IR file!\n");
+        exit(-1);
+    }
+    finishParse();
+}
+
+void parse_fragment(FILE *file, void (*start_)(void *data, char *el, const char **attr),
+                    void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+                    int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_)
+{
+    int savedMaxPoolSize = maxPoolSize;
+    int savedMultiLanguage = multiLanguage;
+    int savedSegmentMode = segmentMode;
+    int savedDeduplicate = deduplicate;
+    int savedPrune = prune;
+    int savedOptimizeMacroCommands = optimizeMacroCommands;
+    int savedRenumberBase = renumberBase;
+    maxPoolSize = 0;
+    multiLanguage = 0;
+    segmentMode = 0;
+    deduplicate = 0;
+    prune = 0;
+    optimizeMacroCommands = 0;
+    renumberBase = -1;
+    inFragment = 1;
+
+    parse(file, start_, end_, ready, vtDimension_, vtSkWidth_, vtSkHeight_, vtColors_);
+
+    inFragment = 0;
+    maxPoolSize = savedMaxPoolSize;
+    multiLanguage = savedMultiLanguage;
+    segmentMode = savedSegmentMode;
+    deduplicate = savedDeduplicate;
+    prune = savedPrune;
+    optimizeMacroCommands = savedOptimizeMacroCommands;
+    renumberBase = savedRenumberBase;
 }
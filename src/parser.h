@@ -44,8 +44,148 @@ typedef struct pool_xform {
 // parsed
 pool_xform_t *get_pool_xform();
 
+// a PictureGraphic that was degraded to fit the pool size budget
+typedef struct pool_degrade {
+    int object_id;
+    int old_size;
+    int new_size;
+    int rle;        // raw data is run-length encoded
+    int colors;     // colors after degrading
+    int width;      // actual width and height after degrading
+    int height;
+} pool_degrade_t;
+
+// an object removed because nothing refers to it
+typedef struct pool_removed {
+    int object_id;
+    int type;
+    int size;
+} pool_removed_t;
+
+typedef struct pool_stats {
+    int picture_cache_hits;
+    int picture_cache_misses;
+    int nro_degraded;
+    pool_degrade_t *degraded;
+    int nro_deduplicated;     // objects merged to an identical object
+    int deduplicated_bytes;
+    int nro_removed;          // objects not reachable from working set
+    pool_removed_t *removed;
+    int removed_bytes;
+    int nro_commands_removed; // overwritten macro commands
+    int nro_macros_merged;    // macros merged to an identical macro
+    int macro_bytes;          // bytes saved by both
+    int renumber_failed;      // the ids didn't fit, the pool has the old ids
+} pool_stats_t;
+
+// statistics about the last parse() call
+pool_stats_t *get_pool_stats();
+
+// converted picture data is cached in the given directory, so that
+// unchanged pictures are not decoded again on the next run. NULL
+// disables the cache (default).
+void set_picture_cache(const char *dir);
+
+// if the pool would be larger than given number of bytes, the largest
+// pictures are degraded until it fits. 0 disables the budget
+// (default). The whole pool is kept in memory before it is passed
+// to ready().
+void set_max_pool_size(int bytes);
+
+// merges identical attribute objects and pictures, see
+// deduplicatePool() in pool.h. Disabled by default.
+void set_deduplicate(int enable);
+
+// removes objects that can't be reached from the working set, see
+// prunePool() in pool.h. Disabled by default.
+void set_prune(int enable);
+
+// removes overwritten macro commands and merges identical macros, see
+// optimizeMacros() in pool.h. Disabled by default.
+void set_optimize_macros(int enable);
+
+// gives every object a new id so that the ids are contiguous starting
+// from base, see renumberPool() in pool.h. Negative base disables
+// renumbering (default).
+void set_renumber(int base);
+
+// remap() is called after an optimization that removes or renumbers
+// objects. new_ids has 65536 entries: new_ids[id] is the id that
+// replaces id in the pool, or -1 if the object was removed.
+void set_remap_function(void (*remap)(const int *new_ids));
+
+// An output sink receives the finished objects in batches instead of
+// one ready() call per object. The spans are valid only during the
+// write() call. size and objects are the totals passed to the sink so
+// far, they are updated by the parser.
+typedef struct pool_span {
+    const char *data;
+    int length;
+} pool_span_t;
+
+typedef struct pool_sink {
+    void (*write)(struct pool_sink *sink, const pool_span_t *spans, int count);
+    int size;
+    int objects;
+} pool_sink_t;
+
+// if a sink is set, parse(), emit_pool() and emit_segment() pass the
+// objects to it and ready() is not called. NULL (default) uses ready().
+void set_output_sink(pool_sink_t *sink);
+
+// In multi-language mode parse() keeps the pool in memory instead of
+// passing it to ready(). String objects may contain language elements
+// (<language code="de" value="..."/>) that give the value for one
+// language. After parsing, emit_pool() can be called once for every
+// language code to get the pool for that language, and free_pool()
+// releases the pool. Language elements of the working set are always
+// added to its language code list.
+void set_multi_language(int enable);
+
+// the language codes found by the last parse() (working set language
+// codes and codes of the string values)
+int get_language_count();
+const char *get_language_code(int index);
+
+// passes the kept pool to ready(), with the string values of given
+// language (NULL gives the default values)
+void emit_pool(const char *language, void (*ready)(char *data, int length));
+void free_pool();
+
+// In segment mode parse() keeps the pool in memory like in
+// multi-language mode and splits it into segments, see segmentPool()
+// in pool.h. Segment 0 is enough to show the first mask, the others
+// can be transferred later. emit_segment() passes the objects of one
+// segment to ready(), emit_pool() and free_pool() work as above.
+void set_segments(int enable);
+int get_segment_count();
+// returns the segment of an object, -1 if it is not in the pool
+int get_segment_of(int object_id);
+void emit_segment(int segment, const char *language, void (*ready)(char *data, int length));
+
 void parse(FILE *file, void (*start_)(void *data, char *el, const char **attr),
     void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
     int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_);
 
+// like parse(), but reads a pre-parsed pool (see ir.h) instead of XML
+void parse_ir(const unsigned char *ir, int length,
+    void (*start_)(void *data, char *el, const char **attr),
+    void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+    int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_);
+
+// Fragments: a root level <include_fragment file="..."/> element puts
+// the objects of a fragment file into the pool at that point. The
+// main program compiles the fragments before the parse, and
+// fragment() returns the objects of one (size bytes of packed
+// objects), or NULL if it has none by that name. A missing fragment,
+// a fragment that includes another one, and an object id that is used
+// by the document and a fragment or by two fragments are parse errors.
+void set_fragment_function(const unsigned char *(*fragment)(const char *file, int *size));
+
+// like parse(), but for compiling a fragment file: the whole pool
+// options (set_prune() etc.) are left to the pool that includes it
+void parse_fragment(FILE *file, void (*start_)(void *data, char *el, const char **attr),
+    void (*end_) (void *data, char *el), void (*ready)(char *data, int length),
+    int vtDimension_, int vtSkWidth_, int vtSkHeight_, int vtColors_);
+
 #endif
@@ -191,13 +191,13 @@ typedef struct
 } InputString;
 
 // returns a pointer to the number of macros
-unsigned char* inputStringMacros(InputString *ptr)
+static inline unsigned char* inputStringMacros(InputString *ptr)
 {
     return ptr->value + ptr->length * sizeof(unsigned char) + 1;
 }
 
 // returns a pointer to enabled-attribute
-unsigned char* inputStringEnabled(InputString *ptr)
+static inline unsigned char* inputStringEnabled(InputString *ptr)
 {
     return ptr->value + ptr->length * sizeof(unsigned char);
 }
@@ -261,7 +261,7 @@ typedef struct
 } OutputString;
 
 // returns a pointer to the number of macros
-unsigned char *outputStringMacros(OutputString *ptr)
+static inline unsigned char *outputStringMacros(OutputString *ptr)
 {
     return ptr->value + ptr->length * sizeof(unsigned char);
 }
@@ -486,7 +486,7 @@ typedef struct
 } InputAttributes;
 
 // returns a pointer to the number of macros
-unsigned char *inputAttributesMacros(InputAttributes *ptr)
+static inline unsigned char *inputAttributesMacros(InputAttributes *ptr)
 {
     return ptr->validationString + ptr->length * sizeof(unsigned char);
 }
@@ -763,7 +763,7 @@ typedef struct
 // object
 
 // names are ordered by object type
-const char *xmlNames[] =
+static const char *const xmlNames[] =
     {"workingset", "datamask", "alarmmask", "container", "softkeymask", "key",
      "button",  "inputboolean",  "inputstring",  "inputnumber",
      "inputlist", "outputstring", "outputnumber",  "line", "rectangle",
@@ -776,7 +776,7 @@ const char *xmlNames[] =
 
 
 // commands-array has xml-names of all supported commands
-const char *commands[] =
+static const char *const commands[] =
     {"command_hide_show_object", "command_enable_disable_object", "command_select_input_object",
      "command_control_audio_device", "command_set_audio_volume", "command_change_child_location",
      "command_change_size", "command_change_background_colour", "command_change_numeric_value",
@@ -788,7 +788,7 @@ const char *commands[] =
 
 // commandFunction-array has the function numbers of the commands in
 // the commands-array
-int commandFunction[] =
+static const int commandFunction[] =
     {160, 161, 162,
      163, 164, 165,
      166, 167, 168,
@@ -798,7 +798,7 @@ int commandFunction[] =
      180, 177};
 
 // XML names of all events, ordered by event number
-const char *events[] =
+static const char *const events[] =
     {"on_activate", "on_deactivate", "on_show", "on_hide", "on_enable", "on_disable",
      "on_change_active_mask", "on_change_soft_key_mask", "on_change_attribute",
      "on_change_background_colour", "on_change_font_attributes", "on_change_line_attributes",
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "picture.h"
+#include "parserdef.h"
+
+// look picture.h for function definitions
+
+int pictureFormat(int colors)
+{
+    if (colors == 16)
+        return 1;
+    if (colors == 256)
+        return 2;
+    return 0;
+}
+
+int pictureColors(int format)
+{
+    if (format == 1)
+        return 16;
+    if (format == 2)
+        return 256;
+    return 2;
+}
+
+// returns the length of one row of raw data
+int pictureRowLength(int width, int colors)
+{
+    if (colors == 16)
+        return (width + 1) / 2;
+    if (colors == 2)
+        return (width + 7) / 8;
+    return width;
+}
+
+unsigned char *packPicture(const unsigned char *pixels, int width, int height,
+                           int colors, int *size)
+{
+    int dataWidth = pictureRowLength(width, colors);
+    unsigned char *data = (unsigned char *) calloc(dataWidth * height + 1, sizeof(char));
+
+    if (colors == 16) {
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x += 2)
+                for (int i = 0; (i < 2) && ((x + i) < width); i++)
+                    data[y * dataWidth + x / 2] += (reduceColor(pixels[y * width + x + i], colors) << (1 - i) * 4);
+    }
+    else if (colors == 2) {
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x += 8)
+                for (int i = 0; (i < 8) && ((x + i) < width); i++)
+                    data[y * dataWidth + x / 8] += (reduceColor(pixels[y * width + x + i], colors) << (7 - i));
+    }
+    else {
+        memcpy(data, pixels, width * height);
+    }
+
+    *size = dataWidth * height;
+    return data;
+}
+
+unsigned char *rlePicture(const unsigned char *data, int width, int height,
+                          int colors, int *size)
+{
+    int dataWidth = pictureRowLength(width, colors);
+    int rawSize = dataWidth * height;
+
+    // worst case is two bytes for every byte
+    unsigned char *rle = (unsigned char *) malloc(2 * rawSize + 2);
+    int length = 0;
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char *row = data + y * dataWidth;
+        for (int x = 0; x < dataWidth; ) {
+            int count = 1;
+            while (x + count < dataWidth && count < 255 && row[x + count] == row[x])
+                count++;
+            rle[length++] = count;
+            rle[length++] = row[x];
+            x += count;
+        }
+        if (length >= rawSize)
+            break;
+    }
+
+    if (length >= rawSize) {
+        free(rle);
+        return NULL;
+    }
+    *size = length;
+    return rle;
+}
+
+unsigned char *unpackPicture(void *object)
+{
+    PictureGraphic *picture = (PictureGraphic *) object;
+    int width = picture->actualWidth;
+    int height = picture->actualHeight;
+    int colors = pictureColors(picture->format);
+    int dataWidth = pictureRowLength(width, colors);
+    unsigned char *raw = ((unsigned char *) object) + sizeof(PictureGraphic);
+    unsigned char *data = raw;
+
+    // decode runs first
+    if (picture->options & PICTURE_OPTION_RLE) {
+        int rawSize = dataWidth * height;
+        data = (unsigned char *) calloc(rawSize + 1, sizeof(char));
+        int length = 0;
+        for (unsigned int i = 0; i + 1 < picture->rawDataLength; i += 2)
+            for (int j = 0; j < raw[i] && length < rawSize; j++)
+                data[length++] = raw[i + 1];
+    }
+
+    unsigned char *pixels = (unsigned char *) malloc(width * height + 1);
+    for (int y = 0; y < height; y++) {
+        const unsigned char *row = data + y * dataWidth;
+        for (int x = 0; x < width; x++) {
+            if (colors == 16)
+                pixels[y * width + x] = (row[x / 2] >> ((1 - x % 2) * 4)) & 0x0F;
+            else if (colors == 2)
+                pixels[y * width + x] = (row[x / 8] >> (7 - x % 8)) & 1;
+            else
+                pixels[y * width + x] = row[x];
+        }
+    }
+
+    if (data != raw)
+        free(data);
+    return pixels;
+}
+
+void setPictureData(void **object, const unsigned char *data, int size)
+{
+    PictureGraphic *picture = (PictureGraphic *) *object;
+    int oldSize = picture->rawDataLength;
+    int macroSize = picture->macros * sizeof(MacroReference);
+    char *start = ((char *) *object) + sizeof(PictureGraphic);
+
+    if (size > oldSize) {
+        *object = realloc(*object, sizeof(PictureGraphic) + size + macroSize);
+        start = ((char *) *object) + sizeof(PictureGraphic);
+    }
+
+    // move macros after the new data
+    memmove(start + size, start + oldSize, macroSize);
+    memmove(start, data, size);
+    ((PictureGraphic *) *object)->rawDataLength = size;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef PICTURE_H
+#define PICTURE_H
+
+// Helpers for the raw data of PictureGraphic objects. Raw data is
+// stored one row after another, each row padded to a full byte: 8
+// pixels per byte with 2 colors, 2 pixels per byte with 16 colors
+// and one pixel per byte with 256 colors.
+
+// option bit telling that the raw data is run-length encoded
+#define PICTURE_OPTION_RLE 4
+
+// returns the format attribute (0, 1 or 2) for given number of colors
+int pictureFormat(int colors);
+
+// returns the number of colors for given format attribute
+int pictureColors(int format);
+
+// packs one byte per pixel data to raw data with the given number of
+// colors, pixel values are reduced to the nearest color. The returned
+// data must be freed!
+unsigned char *packPicture(const unsigned char *pixels, int width, int height,
+                           int colors, int *size);
+
+// run-length encodes raw data as (count, value) pairs, runs don't
+// continue over rows. Returns NULL if encoded data would not be
+// smaller than the original. The returned data must be freed!
+unsigned char *rlePicture(const unsigned char *data, int width, int height,
+                          int colors, int *size);
+
+// unpacks the raw data of a PictureGraphic object to one byte per
+// pixel (run-length encoding is decoded). The returned data must be
+// freed!
+unsigned char *unpackPicture(void *object);
+
+// replaces the raw data of a PictureGraphic object, macros are kept
+void setPictureData(void **object, const unsigned char *data, int size);
+
+#endif
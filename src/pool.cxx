@@ -0,0 +1,1030 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stddef.h>
+
+#include "xml.h"
+#include "cache.h"
+#include "pool.h"
+#include "picture.h"
+#include "parserdef.h"
+
+// look pool.h for function definitions
+
+void **poolObjects = NULL;
+int nroPoolObjects = 0;
+int poolCapacity = 0;
+
+void poolAdd(void *object)
+{
+    if (nroPoolObjects == poolCapacity) {
+        poolCapacity = poolCapacity ? 2 * poolCapacity : 256;
+        poolObjects = (void **) realloc(poolObjects, poolCapacity * sizeof(void *));
+        if (poolObjects == NULL) {
+            printf("out of memory!\n");
+            exit(-1);
+        }
+    }
+    poolObjects[nroPoolObjects++] = object;
+}
+
+int poolSize()
+{
+    int size = 0;
+    for (int i = 0; i < nroPoolObjects; i++)
+        size += getRealSize(poolObjects[i]);
+    return size;
+}
+
+void poolClear()
+{
+    for (int i = 0; i < nroPoolObjects; i++)
+        free(poolObjects[i]);
+    nroPoolObjects = 0;
+}
+
+////////// references //////////
+
+#define NULL_ID 0xFFFF
+
+int readReference(const unsigned char *ref, int bytes)
+{
+    if (bytes == 1)
+        return ref[0];
+    return ref[0] | (ref[1] << 8);
+}
+
+void writeReference(unsigned char *ref, int bytes, int id)
+{
+    ref[0] = id & 0xFF;
+    if (bytes == 2)
+        ref[1] = (id >> 8) & 0xFF;
+}
+
+#define VISIT(type, field) visit(base + offsetof(type, field), 2, context)
+
+// visits a list of ObjectReferences (or plain ids if size is 2)
+void visitList(unsigned char *list, int count, int size, ReferenceVisitor visit, void *context)
+{
+    for (int i = 0; i < count; i++)
+        visit(list + i * size, 2, context);
+}
+
+// visits the macro ids of a list of MacroReferences
+void visitMacros(unsigned char *list, int count, ReferenceVisitor visit, void *context)
+{
+    for (int i = 0; i < count; i++)
+        visit(list + i * sizeof(MacroReference) + offsetof(MacroReference, macroId), 1, context);
+}
+
+// type of the object of every id, 0xFF if there is no such object
+unsigned char objectTypes[NRO_IDS];
+
+void indexObjectTypes()
+{
+    memset(objectTypes, 0xFF, sizeof(objectTypes));
+    for (int i = nroPoolObjects - 1; i >= 0; i--) {
+        ObjectHeader *header = (ObjectHeader *) poolObjects[i];
+        objectTypes[header->objectId] = header->type;
+    }
+}
+
+// returns true if the attribute of given object type is an object id
+// (Change Attribute command)
+int isObjectAttribute(int type, int aid)
+{
+    switch (type) {
+    case 0:  return aid == 3;                   // active mask
+    case 1:  return aid == 2;                   // soft key mask
+    case 2:  return aid == 2;                   // soft key mask
+    case 7:  return aid == 3 || aid == 4;       // foreground colour, variable
+    case 8:  return aid == 4 || aid == 5 || aid == 7;   // font, input attributes, variable
+    case 9:  return aid == 4 || aid == 6;       // font attributes, variable
+    case 10: return aid == 3;                   // variable
+    case 11: return aid == 4 || aid == 6;       // font attributes, variable
+    case 12: return aid == 4 || aid == 6;       // font attributes, variable
+    case 13: return aid == 1;                   // line attributes
+    case 14: return aid == 1 || aid == 5;       // line, fill attributes
+    case 15: return aid == 1 || aid == 7;       // line, fill attributes
+    case 16: return aid == 3 || aid == 4;       // line, fill attributes
+    case 17: return aid == 11;                  // variable
+    case 18: return aid == 9 || aid == 10;      // variable, target variable
+    case 19: return aid == 11 || aid == 12;     // variable, target variable
+    case 25: return aid == 3;                   // fill pattern
+    }
+    return false;
+}
+
+// visits the object ids of one macro command. The type of the changed
+// object is looked up before it is visited, because visit() may
+// rewrite the id.
+void visitCommand(unsigned char *command, ReferenceVisitor visit, void *context)
+{
+    int type = objectTypes[readReference(command + 1, 2)];
+
+    switch (command[0]) {
+    case 168:
+        visit(command + 1, 2, context);
+        if (type == 27)
+            visit(command + offsetof(ChangeNumericValue, value), 2, context);
+        break;
+    case 175:
+        visit(command + 1, 2, context);
+        if (isObjectAttribute(type, command[offsetof(ChangeAttribute, AID)]))
+            visit(command + offsetof(ChangeAttribute, value), 2, context);
+        break;
+    case 160: case 161: case 162: case 166: case 167:
+    case 169: case 170: case 171: case 176: case 179:
+        visit(command + 1, 2, context);
+        break;
+    case 172:
+        visit(command + 1, 2, context);
+        visit(command + offsetof(ChangeFillAttributes, fillPattern), 2, context);
+        break;
+    case 165: case 173: case 180:
+        visit(command + 1, 2, context);
+        visit(command + 3, 2, context);
+        break;
+    case 174:
+        visit(command + offsetof(ChangeSoftKeyMask, parentId), 2, context);
+        visit(command + offsetof(ChangeSoftKeyMask, childId), 2, context);
+        break;
+    case 177:
+        visit(command + offsetof(ChangeListItem, parentId), 2, context);
+        visit(command + offsetof(ChangeListItem, childId), 2, context);
+        break;
+    }
+}
+
+// visits the object ids of the commands in a macro
+void visitCommands(Macro *macro, ReferenceVisitor visit, void *context)
+{
+    unsigned char *command = macro->commands;
+    unsigned char *end = macro->commands + macro->numberOfBytes;
+
+    while (command < end) {
+        visitCommand(command, visit, context);
+        command += getCommandSize(command);
+    }
+}
+
+// object types with a list of ObjectReferences followed by macros
+#define OBJECTS_AND_MACROS(type)                                         \
+    {                                                                   \
+        type *o = (type *) object;                                      \
+        unsigned char *list = base + sizeof(type);                      \
+        visitList(list, o->objects, sizeof(ObjectReference), visit, context); \
+        visitMacros(list + o->objects * sizeof(ObjectReference), o->macros, visit, context); \
+    }
+
+#define MACROS(type) visitMacros(base + sizeof(type), ((type *) object)->macros, visit, context)
+
+void forEachReference(void *object, ReferenceVisitor visit, void *context)
+{
+    unsigned char *base = (unsigned char *) object;
+
+    switch (((ObjectHeader *) object)->type) {
+    case 0:
+        VISIT(WorkingSet, activeMask);
+        OBJECTS_AND_MACROS(WorkingSet);
+        break;
+    case 1:
+        VISIT(DataMask, softKeyMask);
+        OBJECTS_AND_MACROS(DataMask);
+        break;
+    case 2:
+        VISIT(AlarmMask, softKeyMask);
+        OBJECTS_AND_MACROS(AlarmMask);
+        break;
+    case 3:
+        OBJECTS_AND_MACROS(Container);
+        break;
+    case 4:
+        {
+            SoftKeyMask *o = (SoftKeyMask *) object;
+            visitList(base + sizeof(SoftKeyMask), o->objects, 2, visit, context);
+            visitMacros(base + sizeof(SoftKeyMask) + o->objects * 2, o->macros, visit, context);
+        }
+        break;
+    case 5:
+        OBJECTS_AND_MACROS(Key);
+        break;
+    case 6:
+        OBJECTS_AND_MACROS(Button);
+        break;
+    case 7:
+        VISIT(InputBoolean, foregroundColor);
+        VISIT(InputBoolean, variableReference);
+        MACROS(InputBoolean);
+        break;
+    case 8:
+        {
+            InputString *o = (InputString *) object;
+            VISIT(InputString, fontAttributes);
+            VISIT(InputString, inputAttributes);
+            VISIT(InputString, variableReference);
+            visitMacros(inputStringMacros(o) + 1, *inputStringMacros(o), visit, context);
+        }
+        break;
+    case 9:
+        VISIT(InputNumber, fontAttributes);
+        VISIT(InputNumber, variableReference);
+        MACROS(InputNumber);
+        break;
+    case 10:
+        {
+            InputList *o = (InputList *) object;
+            VISIT(InputList, variableReference);
+            visitList(base + sizeof(InputList), o->numberOfListItems, 2, visit, context);
+            visitMacros(base + sizeof(InputList) + o->numberOfListItems * 2, o->macros, visit, context);
+        }
+        break;
+    case 11:
+        {
+            OutputString *o = (OutputString *) object;
+            VISIT(OutputString, fontAttributes);
+            VISIT(OutputString, variableReference);
+            visitMacros(outputStringMacros(o) + 1, *outputStringMacros(o), visit, context);
+        }
+        break;
+    case 12:
+        VISIT(OutputNumber, fontAttributes);
+        VISIT(OutputNumber, variableReference);
+        MACROS(OutputNumber);
+        break;
+    case 13:
+        VISIT(Line, lineAttributes);
+        MACROS(Line);
+        break;
+    case 14:
+        VISIT(Rectangle, lineAttributes);
+        VISIT(Rectangle, fillAttributes);
+        MACROS(Rectangle);
+        break;
+    case 15:
+        VISIT(Ellipse, lineAttributes);
+        VISIT(Ellipse, fillAttributes);
+        MACROS(Ellipse);
+        break;
+    case 16:
+        {
+            Polygon *o = (Polygon *) object;
+            VISIT(Polygon, lineAttributes);
+            VISIT(Polygon, fillAttributes);
+            visitMacros(base + sizeof(Polygon) + o->numberOfPoints * sizeof(Point), o->macros, visit, context);
+        }
+        break;
+    case 17:
+        VISIT(Meter, variableReference);
+        MACROS(Meter);
+        break;
+    case 18:
+        VISIT(LinearBarGraph, variableReference);
+        VISIT(LinearBarGraph, targetValueVariableReference);
+        MACROS(LinearBarGraph);
+        break;
+    case 19:
+        VISIT(ArchedBarGraph, variableReference);
+        VISIT(ArchedBarGraph, targetValueVariableReference);
+        MACROS(ArchedBarGraph);
+        break;
+    case 20:
+        {
+            PictureGraphic *o = (PictureGraphic *) object;
+            visitMacros(base + sizeof(PictureGraphic) + o->rawDataLength, o->macros, visit, context);
+        }
+        break;
+    case 23:
+        MACROS(FontAttributes);
+        break;
+    case 24:
+        MACROS(LineAttributes);
+        break;
+    case 25:
+        VISIT(FillAttributes, fillPattern);
+        MACROS(FillAttributes);
+        break;
+    case 26:
+        {
+            InputAttributes *o = (InputAttributes *) object;
+            visitMacros(inputAttributesMacros(o) + 1, *inputAttributesMacros(o), visit, context);
+        }
+        break;
+    case 27:
+        VISIT(ObjectPointer, value);
+        break;
+    case 28:
+        visitCommands((Macro *) object, visit, context);
+        break;
+    case 29:
+        visitList(base + sizeof(AuxiliaryFunction), ((AuxiliaryFunction *) object)->objects,
+                  sizeof(ObjectReference), visit, context);
+        break;
+    case 30:
+        visitList(base + sizeof(AuxiliaryInput), ((AuxiliaryInput *) object)->objects,
+                  sizeof(ObjectReference), visit, context);
+        break;
+    case 31:
+        visitList(base + sizeof(AuxiliaryFunction2), ((AuxiliaryFunction2 *) object)->objects,
+                  sizeof(ObjectReference), visit, context);
+        break;
+    case 32:
+        visitList(base + sizeof(AuxiliaryInput2), ((AuxiliaryInput2 *) object)->objects,
+                  sizeof(ObjectReference), visit, context);
+        break;
+    }
+}
+
+void identityIds(int *newIds)
+{
+    for (int i = 0; i < NRO_IDS; i++)
+        newIds[i] = i;
+}
+
+// rewrites one reference using the id table given as context
+void remapReference(unsigned char *ref, int bytes, void *context)
+{
+    const int *newIds = (const int *) context;
+    int id = readReference(ref, bytes);
+    if (bytes == 2 && id == NULL_ID)
+        return;
+    if (newIds[id] >= 0)
+        writeReference(ref, bytes, newIds[id]);
+}
+
+void mergeObjects(const int *newIds)
+{
+    int count = 0;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        void *object = poolObjects[i];
+        int id = ((ObjectHeader *) object)->objectId;
+        if (newIds[id] != id) {
+            free(object);
+            continue;
+        }
+        forEachReference(object, remapReference, (void *) newIds);
+        poolObjects[count++] = object;
+    }
+    nroPoolObjects = count;
+}
+
+////////// deduplication //////////
+
+// marks the objects that are changed by macro commands
+void markCommandTarget(unsigned char *ref, int bytes, void *context)
+{
+    int id = readReference(ref, bytes);
+    if (id != NULL_ID)
+        ((char *) context)[id] = 1;
+}
+
+typedef struct
+{
+    unsigned long long hash;
+    int size;
+    int index;
+} ObjectKey;
+
+int compareObjectKeys(const void *a, const void *b)
+{
+    const ObjectKey *x = (const ObjectKey *) a;
+    const ObjectKey *y = (const ObjectKey *) b;
+    if (x->hash != y->hash)
+        return (x->hash < y->hash) ? -1 : 1;
+    if (x->size != y->size)
+        return x->size - y->size;
+    // keep the first object in pool order
+    return x->index - y->index;
+}
+
+// returns true if object can be shared by several parents
+int isDeduplicable(void *object)
+{
+    int type = ((ObjectHeader *) object)->type;
+    return type == 20 || (type >= 23 && type <= 26);
+}
+
+int deduplicatePool(pool_stats_t *stats, int *newIds)
+{
+    int *merge = (int *) malloc(NRO_IDS * sizeof(int));
+    char *targets = (char *) calloc(NRO_IDS, 1);
+    ObjectKey *keys = (ObjectKey *) malloc((nroPoolObjects + 1) * sizeof(ObjectKey));
+    int saved = 0;
+
+    identityIds(newIds);
+    indexObjectTypes();
+    for (int i = 0; i < nroPoolObjects; i++)
+        if (((ObjectHeader *) poolObjects[i])->type == 28)
+            forEachReference(poolObjects[i], markCommandTarget, targets);
+
+    // merging pictures can make fill attributes identical, so repeat
+    // until nothing changes
+    int merged = 1;
+    while (merged) {
+        merged = 0;
+        identityIds(merge);
+
+        // hash everything but the object id
+        int nroKeys = 0;
+        for (int i = 0; i < nroPoolObjects; i++) {
+            void *object = poolObjects[i];
+            if (!isDeduplicable(object) || targets[((ObjectHeader *) object)->objectId])
+                continue;
+            keys[nroKeys].size = getRealSize(object);
+            keys[nroKeys].hash = hashBytes(((char *) object) + 2, keys[nroKeys].size - 2, HASH_SEED);
+            keys[nroKeys].index = i;
+            nroKeys++;
+        }
+        qsort(keys, nroKeys, sizeof(ObjectKey), compareObjectKeys);
+
+        for (int i = 0; i < nroKeys; ) {
+            int j = i + 1;
+            void *canonical = poolObjects[keys[i].index];
+            int canonicalId = ((ObjectHeader *) canonical)->objectId;
+            for (; j < nroKeys && keys[j].hash == keys[i].hash && keys[j].size == keys[i].size; j++) {
+                void *object = poolObjects[keys[j].index];
+                int id = ((ObjectHeader *) object)->objectId;
+                if (id == canonicalId || memcmp(((char *) object) + 2, ((char *) canonical) + 2, keys[j].size - 2) != 0)
+                    continue;
+                merge[id] = canonicalId;
+                saved += keys[j].size;
+                stats->nro_deduplicated++;
+                merged = 1;
+            }
+            i = j;
+        }
+        if (merged) {
+            mergeObjects(merge);
+            for (int id = 0; id < NRO_IDS; id++)
+                newIds[id] = merge[newIds[id]];
+        }
+    }
+
+    stats->deduplicated_bytes += saved;
+    free(keys);
+    free(targets);
+    free(merge);
+    return saved;
+}
+
+////////// macros //////////
+
+typedef struct
+{
+    char *hasEvents;
+    int objectId;
+    int found;
+} EventScan;
+
+// marks the object that has a macro reference as having events
+void markEvents(unsigned char *ref, int bytes, void *context)
+{
+    (void) ref;
+    EventScan *scan = (EventScan *) context;
+    if (bytes == 1)
+        scan->hasEvents[scan->objectId] = 1;
+}
+
+// marks that a command refers to an object with event macros
+void checkEvents(unsigned char *ref, int bytes, void *context)
+{
+    EventScan *scan = (EventScan *) context;
+    int id = readReference(ref, bytes);
+    if (id != NULL_ID && scan->hasEvents[id])
+        scan->found = 1;
+}
+
+// returns a key for the state that a command sets completely, so that
+// an earlier command with the same key has no effect. Returns 0 for
+// commands that are actions or depend on the current state.
+unsigned long long commandKey(unsigned char *command)
+{
+    unsigned long long function = command[0];
+    unsigned long long id = readReference(command + 1, 2);
+
+    switch (command[0]) {
+    case 160: case 161: case 166: case 167: case 168: case 169:
+    case 170: case 171: case 172: case 173: case 176: case 179:
+        return function << 56 | id;
+    case 164:
+        return function << 56;
+    case 174:
+        return function << 56 | readReference(command + offsetof(ChangeSoftKeyMask, parentId), 2);
+    case 175:
+        return function << 56 | (unsigned long long) ((ChangeAttribute *) command)->AID << 16 | id;
+    case 177:
+        return function << 56 | (unsigned long long) ((ChangeListItem *) command)->listIndex << 16 | id;
+    case 180:
+        return function << 56 | (unsigned long long) readReference(command + 3, 2) << 16 | id;
+    default:
+        // select input object, audio and relative location
+        return 0;
+    }
+}
+
+// removes the commands of a macro that are overwritten by a later
+// command of the same macro, returns the number of removed commands
+int optimizeCommands(Macro *macro, EventScan *scan)
+{
+    unsigned char *start = macro->commands;
+    unsigned char *end = macro->commands + macro->numberOfBytes;
+    int nroCommands = 0;
+    for (unsigned char *command = start; command < end; command += getCommandSize(command))
+        nroCommands++;
+
+    unsigned char **commands = (unsigned char **) malloc(nroCommands * sizeof(unsigned char *));
+    unsigned long long *keys = (unsigned long long *) malloc(nroCommands * sizeof(unsigned long long));
+    int i = 0;
+    for (unsigned char *command = start; command < end; command += getCommandSize(command)) {
+        commands[i] = command;
+        // commands on objects with event macros may trigger them, so
+        // they are handled like actions
+        scan->found = 0;
+        visitCommand(command, checkEvents, scan);
+        keys[i++] = scan->found ? 0 : commandKey(command);
+    }
+
+    // walk backwards, keys after the last action are in seen
+    int removed = 0;
+    int nroSeen = 0;
+    unsigned long long *seen = (unsigned long long *) malloc(nroCommands * sizeof(unsigned long long));
+    for (i = nroCommands - 1; i >= 0; i--) {
+        if (keys[i] == 0) {
+            nroSeen = 0;
+            continue;
+        }
+        int j = 0;
+        while (j < nroSeen && seen[j] != keys[i])
+            j++;
+        if (j < nroSeen) {
+            commands[i] = NULL;
+            removed++;
+        }
+        else
+            seen[nroSeen++] = keys[i];
+    }
+
+    if (removed > 0) {
+        unsigned char *to = start;
+        for (i = 0; i < nroCommands; i++) {
+            if (commands[i] == NULL)
+                continue;
+            int size = getCommandSize(commands[i]);
+            memmove(to, commands[i], size);
+            to += size;
+        }
+        macro->numberOfBytes = to - start;
+    }
+
+    free(seen);
+    free(keys);
+    free(commands);
+    return removed;
+}
+
+int optimizeMacros(pool_stats_t *stats, int *newIds)
+{
+    EventScan scan;
+    scan.hasEvents = (char *) calloc(NRO_IDS, 1);
+    int saved = 0;
+
+    identityIds(newIds);
+    indexObjectTypes();
+    for (int i = 0; i < nroPoolObjects; i++) {
+        scan.objectId = ((ObjectHeader *) poolObjects[i])->objectId;
+        forEachReference(poolObjects[i], markEvents, &scan);
+    }
+
+    // the command streams
+    for (int i = 0; i < nroPoolObjects; i++) {
+        Macro *macro = (Macro *) poolObjects[i];
+        if (macro->type != 28)
+            continue;
+        int size = macro->numberOfBytes;
+        stats->nro_commands_removed += optimizeCommands(macro, &scan);
+        saved += size - macro->numberOfBytes;
+    }
+
+    // identical macros, the first one is kept. Merging only drops ids,
+    // so the macro references keep fitting in 8 bits.
+    int merged = 0;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        Macro *macro = (Macro *) poolObjects[i];
+        if (macro->type != 28 || newIds[macro->objectId] != macro->objectId)
+            continue;
+        for (int j = i + 1; j < nroPoolObjects; j++) {
+            Macro *other = (Macro *) poolObjects[j];
+            if (other->type != 28 || other->numberOfBytes != macro->numberOfBytes
+                || newIds[other->objectId] != other->objectId
+                || memcmp(macro->commands, other->commands, macro->numberOfBytes) != 0)
+                continue;
+            newIds[other->objectId] = macro->objectId;
+            saved += getRealSize(other);
+            stats->nro_macros_merged++;
+            merged = 1;
+        }
+    }
+    if (merged)
+        mergeObjects(newIds);
+
+    stats->macro_bytes += saved;
+    free(scan.hasEvents);
+    return saved;
+}
+
+////////// unreachable objects //////////
+
+typedef struct
+{
+    int *stack;
+    int count;
+    char *reached;
+} Reachability;
+
+// marks a referenced object as reached
+void reachReference(unsigned char *ref, int bytes, void *context)
+{
+    Reachability *r = (Reachability *) context;
+    int id = readReference(ref, bytes);
+    if ((bytes == 2 && id == NULL_ID) || r->reached[id])
+        return;
+    r->reached[id] = 1;
+    r->stack[r->count++] = id;
+}
+
+// returns true if object is a root of the reference graph
+int isRootObject(void *object)
+{
+    int type = ((ObjectHeader *) object)->type;
+    return type == 0 || (type >= 29 && type <= 32);
+}
+
+int prunePool(pool_stats_t *stats, int *newIds)
+{
+    int *indexOf = (int *) malloc(NRO_IDS * sizeof(int));
+    Reachability r;
+    r.stack = (int *) malloc(NRO_IDS * sizeof(int));
+    r.reached = (char *) calloc(NRO_IDS, 1);
+    r.count = 0;
+
+    identityIds(newIds);
+    indexObjectTypes();
+    for (int i = 0; i < NRO_IDS; i++)
+        indexOf[i] = -1;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        int id = ((ObjectHeader *) poolObjects[i])->objectId;
+        if (indexOf[id] < 0)
+            indexOf[id] = i;
+        if (isRootObject(poolObjects[i]) && !r.reached[id]) {
+            r.reached[id] = 1;
+            r.stack[r.count++] = id;
+        }
+    }
+
+    // depth first search over the references
+    while (r.count > 0) {
+        int id = r.stack[--r.count];
+        if (indexOf[id] >= 0)
+            forEachReference(poolObjects[indexOf[id]], reachReference, &r);
+    }
+
+    int saved = 0;
+    int count = 0;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        void *object = poolObjects[i];
+        ObjectHeader *header = (ObjectHeader *) object;
+        if (r.reached[header->objectId]) {
+            poolObjects[count++] = object;
+            continue;
+        }
+
+        stats->removed = (pool_removed_t *) realloc(stats->removed,
+            (stats->nro_removed + 1) * sizeof(pool_removed_t));
+        pool_removed_t *entry = &stats->removed[stats->nro_removed++];
+        entry->object_id = header->objectId;
+        entry->type = header->type;
+        entry->size = getRealSize(object);
+        saved += entry->size;
+
+        newIds[header->objectId] = -1;
+        free(object);
+    }
+    nroPoolObjects = count;
+    stats->removed_bytes += saved;
+
+    free(r.reached);
+    free(r.stack);
+    free(indexOf);
+    return saved;
+}
+
+////////// renumbering //////////
+
+// reports references to objects that are not in the pool
+void checkReference(unsigned char *ref, int bytes, void *context)
+{
+    const char *exists = (const char *) context;
+    int id = readReference(ref, bytes);
+    if (!(bytes == 2 && id == NULL_ID) && !exists[id])
+        printf("WARNING: reference to missing object %d is not renumbered\n", id);
+}
+
+int renumberPool(int base, int *newIds)
+{
+    char *exists = (char *) calloc(NRO_IDS, 1);
+    int first = base < 256 ? base : 0;
+    int next = first;
+    int used = 0;
+
+    identityIds(newIds);
+    indexObjectTypes();
+
+    // macros first, then everything else in pool order
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < nroPoolObjects; i++) {
+            ObjectHeader *header = (ObjectHeader *) poolObjects[i];
+            if ((header->type == 28) == (pass == 0) && !exists[header->objectId]) {
+                exists[header->objectId] = 1;
+                newIds[header->objectId] = next++;
+                used++;
+            }
+        }
+        if (pass == 0 && next > 256) {
+            printf("ERROR: %d macros don't fit in 8 bit ids from %d, not renumbered!\n",
+                   next - first, first);
+            next = -1;
+            break;
+        }
+        // with a base above the 8 bit range the macros are numbered
+        // from 0 and the other objects from base
+        if (pass == 0 && next < base)
+            next = base;
+    }
+    if (next > NULL_ID) {
+        printf("ERROR: %d objects don't fit in ids from %d, not renumbered!\n",
+               used, base);
+        next = -1;
+    }
+    if (next < 0) {
+        identityIds(newIds);
+        free(exists);
+        return -1;
+    }
+
+    for (int i = 0; i < nroPoolObjects; i++) {
+        ObjectHeader *header = (ObjectHeader *) poolObjects[i];
+        forEachReference(header, checkReference, exists);
+        forEachReference(header, remapReference, newIds);
+        header->objectId = newIds[header->objectId];
+    }
+
+    free(exists);
+    return used;
+}
+
+////////// segments //////////
+
+// like reachReference(), but doesn't follow the data and alarm masks
+// in macro commands, they get segments of their own
+void reachSegmentReference(unsigned char *ref, int bytes, void *context)
+{
+    int type = objectTypes[readReference(ref, bytes)];
+    if (bytes == 2 && (type == 1 || type == 2))
+        return;
+    reachReference(ref, bytes, context);
+}
+
+// adds the objects reachable from the pool object at index that are
+// not yet in any segment to given segment
+void addReachable(int index, int segment, int *segments, const int *indexOf, Reachability *r)
+{
+    int id = ((ObjectHeader *) poolObjects[index])->objectId;
+    if (r->reached[id])
+        return;
+    r->reached[id] = 1;
+    r->stack[r->count++] = id;
+
+    while (r->count > 0) {
+        id = r->stack[--r->count];
+        if (indexOf[id] < 0)
+            continue;
+        void *object = poolObjects[indexOf[id]];
+        segments[indexOf[id]] = segment;
+        if (((ObjectHeader *) object)->type == 28)
+            forEachReference(object, reachSegmentReference, r);
+        else
+            forEachReference(object, reachReference, r);
+    }
+}
+
+int segmentPool(int *segments)
+{
+    int *indexOf = (int *) malloc(NRO_IDS * sizeof(int));
+    Reachability r;
+    r.stack = (int *) malloc(NRO_IDS * sizeof(int));
+    r.reached = (char *) calloc(NRO_IDS, 1);
+    r.count = 0;
+
+    indexObjectTypes();
+    for (int i = 0; i < NRO_IDS; i++)
+        indexOf[i] = -1;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        int id = ((ObjectHeader *) poolObjects[i])->objectId;
+        if (indexOf[id] < 0)
+            indexOf[id] = i;
+        segments[i] = -1;
+    }
+
+    // boot segment: working sets, the active masks and everything they
+    // refer to
+    for (int i = 0; i < nroPoolObjects; i++)
+        if (((ObjectHeader *) poolObjects[i])->type == 0)
+            addReachable(i, 0, segments, indexOf, &r);
+
+    // a segment for every other data or alarm mask
+    int nroSegments = 1;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        int type = ((ObjectHeader *) poolObjects[i])->type;
+        if (segments[i] < 0 && (type == 1 || type == 2))
+            addReachable(i, nroSegments++, segments, indexOf, &r);
+    }
+
+    // and one for the rest (auxiliary objects and objects that are not
+    // used by any mask)
+    int rest = 0;
+    for (int i = 0; i < nroPoolObjects; i++) {
+        if (segments[i] < 0) {
+            addReachable(i, nroSegments, segments, indexOf, &r);
+            segments[i] = nroSegments;
+            rest = 1;
+        }
+    }
+    nroSegments += rest;
+
+    free(r.reached);
+    free(r.stack);
+    free(indexOf);
+    return nroSegments;
+}
+
+////////// size budget //////////
+
+#define DEGRADE_RLE 0
+#define DEGRADE_COLORS 1
+#define DEGRADE_SCALE 2
+
+// applies one degrade step to a picture, returns 1 if the picture was
+// changed
+int degradePicture(void **object, int step)
+{
+    PictureGraphic *picture = (PictureGraphic *) *object;
+    int width = picture->actualWidth;
+    int height = picture->actualHeight;
+    int colors = pictureColors(picture->format);
+    int rle = (picture->options & PICTURE_OPTION_RLE) != 0;
+
+    if (step == DEGRADE_RLE && rle)
+        return 0;
+    if (step == DEGRADE_COLORS && colors == 2)
+        return 0;
+    if (step == DEGRADE_SCALE && width <= 1 && height <= 1)
+        return 0;
+    if (picture->rawDataLength == 0)
+        return 0;
+
+    unsigned char *pixels = unpackPicture(*object);
+
+    if (step == DEGRADE_COLORS)
+        colors = (colors == 256) ? 16 : 2;
+
+    // nearest neighbour, the VT scales the picture back to its width
+    if (step == DEGRADE_SCALE) {
+        int newWidth = (width + 1) / 2;
+        int newHeight = (height + 1) / 2;
+        for (int y = 0; y < newHeight; y++)
+            for (int x = 0; x < newWidth; x++)
+                pixels[y * newWidth + x] = pixels[2 * y * width + 2 * x];
+        width = newWidth;
+        height = newHeight;
+    }
+
+    int size;
+    unsigned char *data = packPicture(pixels, width, height, colors, &size);
+    free(pixels);
+
+    if (rle || step == DEGRADE_RLE) {
+        int rleSize;
+        unsigned char *rleData = rlePicture(data, width, height, colors, &rleSize);
+        if (rleData == NULL && step == DEGRADE_RLE) {
+            free(data);
+            return 0;
+        }
+        if (rleData != NULL) {
+            free(data);
+            data = rleData;
+            size = rleSize;
+        }
+        rle = rleData != NULL;
+    }
+
+    picture->actualWidth = width;
+    picture->actualHeight = height;
+    if (pictureFormat(colors) != picture->format) {
+        picture->format = pictureFormat(colors);
+        picture->transparencyColor = reduceColor(picture->transparencyColor, colors);
+    }
+    if (rle)
+        picture->options |= PICTURE_OPTION_RLE;
+    else
+        picture->options &= ~PICTURE_OPTION_RLE;
+
+    setPictureData(object, data, size);
+    free(data);
+    return 1;
+}
+
+// adds or updates the entry of a degraded picture
+void recordDegrade(pool_stats_t *stats, void *object, int oldSize)
+{
+    PictureGraphic *picture = (PictureGraphic *) object;
+    pool_degrade_t *entry = NULL;
+
+    for (int i = 0; i < stats->nro_degraded; i++)
+        if (stats->degraded[i].object_id == picture->objectId)
+            entry = &stats->degraded[i];
+
+    if (entry == NULL) {
+        stats->degraded = (pool_degrade_t *) realloc(stats->degraded,
+            (stats->nro_degraded + 1) * sizeof(pool_degrade_t));
+        entry = &stats->degraded[stats->nro_degraded++];
+        entry->object_id = picture->objectId;
+        entry->old_size = oldSize;
+    }
+    entry->new_size = getRealSize(object);
+    entry->rle = (picture->options & PICTURE_OPTION_RLE) != 0;
+    entry->colors = pictureColors(picture->format);
+    entry->width = picture->actualWidth;
+    entry->height = picture->actualHeight;
+}
+
+int compareSizeDescending(const void *a, const void *b)
+{
+    return getRealSize(poolObjects[*(const int *) b]) - getRealSize(poolObjects[*(const int *) a]);
+}
+
+int fitPool(int maxSize, pool_stats_t *stats)
+{
+    int size = poolSize();
+    int *pictures = (int *) malloc((nroPoolObjects + 1) * sizeof(int));
+    int nroPictures = 0;
+
+    for (int i = 0; i < nroPoolObjects; i++)
+        if (((ObjectHeader *) poolObjects[i])->type == 20)
+            pictures[nroPictures++] = i;
+
+    for (int step = DEGRADE_RLE; step <= DEGRADE_SCALE && size > maxSize; step++) {
+        // color depth and scale can be reduced several times, keep
+        // going as long as some picture still changes
+        int changed = 1;
+        while (changed && size > maxSize) {
+            changed = 0;
+            qsort(pictures, nroPictures, sizeof(int), compareSizeDescending);
+            for (int i = 0; i < nroPictures && size > maxSize; i++) {
+                void **object = &poolObjects[pictures[i]];
+                int oldSize = getRealSize(*object);
+                if (degradePicture(object, step)) {
+                    size += getRealSize(*object) - oldSize;
+                    recordDegrade(stats, *object, oldSize);
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    free(pictures);
+    return size;
+}
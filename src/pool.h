@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "parser.h"
+
+// Whole pool operations. When an option needs to see the complete
+// pool before anything is written (for example the size budget), the
+// finished objects are collected here instead of passing them
+// directly to the ready callback.
+
+// collected objects in the order they were finished
+extern void **poolObjects;
+extern int nroPoolObjects;
+
+// returns the real size of an object (see parser.cxx)
+int getRealSize(void *object);
+
+// adds a finished object to the pool, pool takes care of freeing it
+void poolAdd(void *object);
+
+// returns the size of the collected pool in bytes
+int poolSize();
+
+// frees all collected objects
+void poolClear();
+
+// returns the size of a command in a macro (see parser.cxx)
+int getCommandSize(const void *object);
+
+// calls visit() for every object id an object refers to: contained
+// objects, attribute objects, macro references, ObjectPointer values
+// and object ids in macro commands. ref points to the id in the
+// object, bytes is 2 for object ids and 1 for macro ids.
+//
+// Whether the value of a Change Numeric Value or Change Attribute
+// command is an object id depends on the type of the object it
+// changes, so the types are looked up from a table that
+// indexObjectTypes() fills from the pool. The passes below call it
+// before they visit references.
+typedef void (*ReferenceVisitor)(unsigned char *ref, int bytes, void *context);
+void forEachReference(void *object, ReferenceVisitor visit, void *context);
+void indexObjectTypes();
+
+// reads and writes a little endian id visited by forEachReference()
+int readReference(const unsigned char *ref, int bytes);
+void writeReference(unsigned char *ref, int bytes, int id);
+
+// Passes that change object ids fill a table of NRO_IDS entries:
+// newIds[id] is the id that replaces id in the pool, or -1 if the
+// object was removed. Ids that don't change map to themselves.
+#define NRO_IDS 65536
+
+// sets every id of the table to map to itself
+void identityIds(int *newIds);
+
+// rewrites every reference in the pool with newIds, and removes the
+// objects whose own id is mapped to another object
+void mergeObjects(const int *newIds);
+
+// merges byte-identical attribute objects (font, line, fill and input
+// attributes) and pictures that have different ids. References are
+// rewritten to the object that is kept. Objects that are changed by
+// macro commands are never merged. Returns the number of bytes saved.
+int deduplicatePool(pool_stats_t *stats, int *newIds);
+
+// removes macro commands that are overwritten by a later command of
+// the same macro (for example hide and show of the same object), and
+// then merges byte-identical macros. Commands are not removed across
+// actions (select input object, audio, relative location) or if they
+// refer to an object that has event macros, because those depend on
+// or trigger the intermediate state. Returns the number of bytes saved.
+int optimizeMacros(pool_stats_t *stats, int *newIds);
+
+// removes every object that can't be reached from a working set by
+// following references (see forEachReference()). This includes the
+// objects that macros put into object pointers or attributes, even if
+// nothing else refers to them. Auxiliary function and input objects
+// are kept, because they are used without being referenced. Note that
+// masks that are only activated by the ECU at run-time are removed
+// too. The removed objects are listed in stats. Returns the number of
+// bytes saved.
+int prunePool(pool_stats_t *stats, int *newIds);
+
+// renumbers the objects to ids base, base + 1, ... in pool order,
+// except that macros come first because they are referred to with 8
+// bit ids. If base is 256 or more, the macros are numbered from 0 and
+// the other objects from base. All references are rewritten,
+// including object ids in the values of macro commands. Returns the
+// number of ids used, or -1 if the ids would not fit (nothing is
+// changed then).
+int renumberPool(int base, int *newIds);
+
+// splits the pool into segments that can be transferred one after
+// another, so that the VT can show the first mask before the whole
+// pool is loaded. Segment 0 has the working sets, their active masks
+// and everything they refer to. Then every other data and alarm mask
+// gets a segment with the objects it refers to that are not in an
+// earlier segment, and the last segment has the rest. A segment only
+// refers to objects of itself or earlier segments, except for the
+// data and alarm masks in macro commands (e.g. Change Active Mask):
+// these are not followed, so a mask that a macro switches to gets a
+// segment of its own instead of ending up in the boot segment.
+// segments[i] is set to the segment of poolObjects[i]. Returns the
+// number of segments.
+int segmentPool(int *segments);
+
+// degrades the largest PictureGraphic objects until the pool fits in
+// maxSize bytes: first run-length encoding, then lower color depth
+// and last halving the image size. Degraded pictures are listed in
+// stats. Returns the new pool size.
+int fitPool(int maxSize, pool_stats_t *stats);
+
+#endif
@@ -23,8 +23,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #include "parser.h"
+#include "batch.h"
+#include "cache.h"
+#include "daemon.h"
+#include "index.h"
+#include "ir.h"
+#include "lz.h"
+#include "share.h"
+#include "sink.h"
+#include "watch.h"
 #include "xml.h"
 
 #define VERSION "1.6.0"
@@ -53,6 +69,54 @@ int depth = 0;
 int printTable = false;
 int pythonTable = false;
 int firstByte = true;
+int languagePools = false;
+int segments = false;
+
+// sink that writes the binary format, NULL with -table and -python
+pool_sink_t *sink = NULL;
+int writeIndex = false;
+int asmOutput = false;
+
+// with -compress the binary format is compressed before the file sink
+int compressPool = false;
+pool_sink_t *compressSink = NULL;
+int compressed_size = 0;
+
+// with -compile-ir the XML file is only converted to an IR file
+int compileIr = false;
+
+// pool size budget, 0 if not in use
+int maxSize = 0;
+
+// original id -> id in the output pool, only kept with -renumber
+int *idMap = NULL;
+
+// index of the previous pool with -delta
+IndexEntry *deltaEntries = NULL;
+int deltaCount = 0;
+
+// directory of the compiled pool cache, NULL if not in use, and the
+// size it is kept under
+const char *poolCacheDir = NULL;
+long long poolCacheSize = 256LL * 1024 * 1024;
+
+// directory of the parsed documents (IR) by the hash of the XML, NULL
+// if not in use. It is kept under the size of the pool cache.
+const char *documentCacheDir = NULL;
+
+// hash of the options that change the generated pool
+unsigned long long optionKey = HASH_SEED;
+
+// the fragments must be in this directory or below it, NULL if they
+// can be anywhere
+const char *includeRoot = NULL;
+
+// with -watch the input is compiled again whenever it changes
+int watchMode = false;
+
+// with -memfd the pool is sent in a memory file to the socket named by
+// the output argument (see share.h)
+int sharedPool = false;
 
 //
 // function for adding a new string to the linked list
@@ -80,6 +144,40 @@ void addToList(char *name, int id)
     }
 }
 
+//
+// callback function, called when objects of the pool get new ids
+//
+void remapList(const int *newIds)
+{
+    node_t *prev = NULL;
+    node_t *node = list_start;
+    while (node != NULL) {
+        node_t *next = node->tail;
+        if (newIds[node->id] < 0) {
+            // object was removed from the pool
+            if (prev == NULL)
+                list_start = next;
+            else
+                prev->tail = next;
+            if (node == list_end)
+                list_end = prev;
+            printf("* removed unreferenced object: %s (%d)\n", node->name, node->id);
+            free(node->name);
+            free(node);
+        }
+        else {
+            node->id = newIds[node->id];
+            prev = node;
+        }
+        node = next;
+    }
+
+    if (idMap != NULL)
+        for (int i = 0; i < 65536; i++)
+            if (idMap[i] >= 0)
+                idMap[i] = newIds[idMap[i]];
+}
+
 //
 // function for printing the linked list
 //
@@ -104,62 +202,156 @@ void pythonList()
 }
 
 //
-// callback function that prints ascii formatted numbers to file
+// functions for printing the ids that were changed by -renumber, as
+// pairs of original id and id in the pool
 //
-void ascii_ready(char *data, int length)
+void printRemap()
 {
-    const int obj_id = (length >= 2) ? data[0] + (data[1] << 8) : -1;
-    const int obj_type = (length >= 3) ? data[2] : -1;
+    int count = 0;
+    for (int i = 0; i < 65536; i++)
+        if (idMap[i] >= 0 && idMap[i] != i)
+            count++;
 
-    for (int i = 0; i < length; i++) {
-        if (firstByte) {
-            firstByte = false;
-            fprintf(fileOut, "  /* %d, %d */ ", obj_id, obj_type);
-        }
-        else if (i == 0) {
-            fprintf(fileOut, ",\n  /* %d, %d */ ", obj_id, obj_type);
-        }
-        else {
-            fprintf(fileOut, ", ");
+    fprintf(fileOut, "\n#define POOL_REMAP_SIZE %d\n\n", count);
+    if (count == 0)
+        return;
+    fprintf(fileOut, "const unsigned short pool_remap[POOL_REMAP_SIZE][2] = {\n");
+    for (int i = 0; i < 65536; i++)
+        if (idMap[i] >= 0 && idMap[i] != i)
+            fprintf(fileOut, "    {%d, %d}%s\n", i, idMap[i], --count > 0 ? "," : "");
+    fprintf(fileOut, "};\n");
+}
+
+void pythonRemap()
+{
+    fprintf(fileOut, "\nremap = {\n");
+    for (int i = 0; i < 65536; i++)
+        if (idMap[i] >= 0 && idMap[i] != i)
+            fprintf(fileOut, "    %d: %d,\n", i, idMap[i]);
+    fprintf(fileOut, "}\n");
+}
+
+//
+// buffered text output. Every byte is written as ", " and its decimal
+// value, taken from a table that is built once.
+//
+#define TEXT_BUFFER_SIZE (256 * 1024)
+char textBuffer[TEXT_BUFFER_SIZE];
+int textUsed = 0;
+char byteText[256][6];
+int byteTextLength[256];
+
+void initByteText()
+{
+    for (int i = 0; i < 256; i++)
+        byteTextLength[i] = sprintf(byteText[i], ", %d", i);
+}
+
+void flushText()
+{
+    fwrite(textBuffer, 1, textUsed, fileOut);
+    textUsed = 0;
+}
+
+// writes the bytes of an object, first and next are the printf
+// formats of the comment before the first and the following objects
+void text_ready(char *data, int length, const char *first, const char *next)
+{
+    if (length > 0) {
+        const int obj_id = (length >= 2) ? data[0] + (data[1] << 8) : -1;
+        const int obj_type = (length >= 3) ? data[2] : -1;
+        if (textUsed + 64 > TEXT_BUFFER_SIZE)
+            flushText();
+        textUsed += sprintf(textBuffer + textUsed, firstByte ? first : next, obj_id, obj_type);
+        firstByte = false;
+
+        // the first byte without separator
+        const char *text = byteText[(unsigned char) data[0]] + 2;
+        int textLength = byteTextLength[(unsigned char) data[0]] - 2;
+        for (int i = 0; ; ) {
+            if (textUsed + 8 > TEXT_BUFFER_SIZE)
+                flushText();
+            memcpy(textBuffer + textUsed, text, textLength);
+            textUsed += textLength;
+            if (++i == length)
+                break;
+            text = byteText[(unsigned char) data[i]];
+            textLength = byteTextLength[(unsigned char) data[i]];
         }
-        fprintf(fileOut, "%i", (unsigned char) data[i]);
     }
     pool_size += length;
     nro_total_objects++;
 }
 
+//
+// callback function that prints ascii formatted numbers to file
+//
+void ascii_ready(char *data, int length)
+{
+    text_ready(data, length, "  /* %d, %d */ ", ",\n  /* %d, %d */ ");
+}
+
 void python_ready(char *data, int length)
 {
-    const int obj_id = (length >= 2) ? data[0] + (data[1] << 8) : -1;
-    const int obj_type = (length >= 3) ? data[2] : -1;
+    text_ready(data, length, "    # %d, %d\n    ", ",\n    # %d, %d\n    ");
+}
 
-    for (int i = 0; i < length; i++) {
-        if (firstByte) {
-            firstByte = false;
-            fprintf(fileOut, "    # %d, %d\n    ", obj_id, obj_type);
-        }
-        else if (i == 0) {
-            fprintf(fileOut, ",\n    # %d, %d\n    ", obj_id, obj_type);
-        }
-        else {
-            fprintf(fileOut, ", ");
-        }
-        fprintf(fileOut, "%i", (unsigned char) data[i]);
-    }
-    pool_size += length;
-    nro_total_objects++;
+//
+// a fragment file included in the pool, compiled for the VT profile
+// of the pool
+//
+typedef struct
+{
+    char *file;                 // as written in the include_fragment element
+    unsigned long long key;
+    pool_image_t image;
+    pool_image_t *compiled;     // NULL if the image is in a cache entry
+    const void *entry;
+    int entryLength;
+    node_t *names;              // names of the root level objects
+    int nroRootObjects;
+} Fragment;
+
+#define MAX_FRAGMENTS 256
+Fragment fragments[MAX_FRAGMENTS];
+int nroFragments = 0;
+int compilingFragment = false;
+
+//
+// returns the fragment of given include_fragment file, NULL if there
+// is none
+//
+Fragment *findFragment(const char *file)
+{
+    for (int i = 0; file != NULL && i < nroFragments; i++)
+        if (strcmp(fragments[i].file, file) == 0)
+            return &fragments[i];
+    return NULL;
 }
 
 //
-// callback function that prints raw bytes to file
+// callback function of the parser, returns the objects of a fragment
 //
-void binary_ready(char *data, int length)
+const unsigned char *fragmentObjects(const char *file, int *size)
 {
-    for (int i = 0; i < length; i++) {
-        fputc((unsigned char) data[i], fileOut);
-    }
-    pool_size += length;
-    nro_total_objects++;
+    Fragment *fragment = compilingFragment ? NULL : findFragment(file);
+    if (fragment == NULL)
+        return NULL;
+    *size = fragment->image.size;
+    return fragment->image.data;
+}
+
+//
+// adds the names of the root level objects of a fragment to the list
+//
+void addFragmentNames(const char *file)
+{
+    Fragment *fragment = compilingFragment ? NULL : findFragment(file);
+    if (fragment == NULL)
+        return;
+    for (node_t *node = fragment->names; node != NULL; node = node->tail)
+        addToList(strdup(node->name), node->id);
+    nro_root_objects += fragment->nroRootObjects;
 }
 
 //
@@ -168,12 +360,13 @@ void binary_ready(char *data, int length)
 void starts(void *userData, char *el, const char ** attr)
 {
     (void) userData;
-    (void) el;
 
     char *name;
     int id;
 
-    if (depth == 1) {
+    if (depth == 1 && strcmp(el, "include_fragment") == 0)
+        addFragmentNames(getAttribute(attr, "file"));
+    else if (depth == 1) {
         name = getName(attr);
         id = getId(attr);
         addToList(strdup(name), id);
@@ -182,6 +375,15 @@ void starts(void *userData, char *el, const char ** attr)
     depth++;
 }
 
+//
+// callback function of compileRoots()
+//
+void addRoot(char *name, int id)
+{
+    addToList(strdup(name), id);
+    nro_root_objects++;
+}
+
 //
 // callback function
 //
@@ -192,23 +394,1224 @@ void ends(void *userData, char *el)
     depth--;
 }
 
+//
+// functions for writing the start and the end of the output file
+//
+void writeHeader()
+{
+    if (printTable)
+        fprintf(fileOut, "unsigned char *pool = {\n");
+    else if (pythonTable)
+        fprintf(fileOut, "pool = [\n");
+    else {
+        sink = open_file_sink(fileOut);
+        set_output_sink(sink);
+        if (compressPool) {
+            compressSink = open_compress_sink(sink);
+            set_output_sink(compressSink);
+        }
+    }
+}
+
+void writeFooter()
+{
+    flushText();
+    if (compressSink != NULL) {
+        pool_size += compressSink->size;
+        nro_total_objects += compressSink->objects;
+        compressed_size += sink->size;
+        close_compress_sink(compressSink);
+        compressSink = NULL;
+        close_file_sink(sink);
+        set_output_sink(NULL);
+        sink = NULL;
+    }
+    else if (sink != NULL) {
+        pool_size += sink->size;
+        nro_total_objects += sink->objects;
+        close_file_sink(sink);
+        set_output_sink(NULL);
+        sink = NULL;
+    }
+    else if (printTable) {
+        fprintf(fileOut, "\n};\n\n#define POOL_SIZE %d\n\n", pool_size);
+        printList();
+        if (idMap != NULL)
+            printRemap();
+    }
+    else if (pythonTable) {
+        fprintf(fileOut, "\n]\n\nPOOL_SIZE = %d\n\n", pool_size);
+        pythonList();
+        if (idMap != NULL)
+            pythonRemap();
+    }
+}
+
+//
+// returns the length of the output file name without extension
+//
+int baseLength(const char *fileName)
+{
+    const char *ext = strrchr(fileName, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL || strchr(ext, '\\') != NULL)
+        return strlen(fileName);
+    return ext - fileName;
+}
+
+//
+// returns the output file name with given part added before the
+// extension (out.h -> out.de.h)
+//
+void fileNameWith(char *name, int size, const char *fileName, const char *part)
+{
+    int length = baseLength(fileName);
+    snprintf(name, size, "%.*s.%s%s", length, fileName, part, fileName + length);
+}
+
+//
+// writes the pool of one language and/or one segment to its own file,
+// the language code and segment number are added to the output file
+// name (out.h -> out.de.h, out.seg1.h, out.de.seg1.h). NULL language
+// gives the default values and negative segment the whole pool.
+//
+void writePoolFile(const char *fileName, const char *language, int segment,
+                   void (*ready)(char *data, int length))
+{
+    char part[32];
+    char name[1024];
+    if (segment < 0)
+        snprintf(part, sizeof(part), "%s", language);
+    else if (language == NULL)
+        snprintf(part, sizeof(part), "seg%d", segment);
+    else
+        snprintf(part, sizeof(part), "%s.seg%d", language, segment);
+    fileNameWith(name, sizeof(name), fileName, part);
+
+    fileOut = fopen(name, "w");
+    if (fileOut == NULL) {
+        printf("Can't open file: %s\n", name);
+        exit(-3);
+    }
+    pool_size = 0;
+    nro_total_objects = 0;
+    firstByte = true;
+
+    writeHeader();
+    if (segment < 0)
+        emit_pool(language, ready);
+    else
+        emit_segment(segment, language, ready);
+    writeFooter();
+    fclose(fileOut);
+
+    if (segment < 0)
+        printf("* language %s: %s, pool size: %d\n", language, name, pool_size);
+    else
+        printf("* segment %d: %s, size: %d, objects: %d\n", segment, name,
+               pool_size, nro_total_objects);
+}
+
+//
+// writes an assembler file that includes the binary pool with .incbin
+// (out.s) and a header with its size and the object ids (out.h). The
+// assembler file is for ELF targets, pool is aligned to 4 bytes.
+//
+void writeAsm(const char *fileName, const char *binName)
+{
+    char name[1024];
+    snprintf(name, sizeof(name), "%.*s.s", baseLength(fileName), fileName);
+    FILE *file = fopen(name, "w");
+    if (file == NULL) {
+        printf("Can't open file: %s\n", name);
+        exit(-3);
+    }
+    fprintf(file,
+            "    .section .rodata\n"
+            "    .global pool\n"
+            "    .type pool, %%object\n"
+            "    .balign 4\n"
+            "pool:\n"
+            "    .incbin \"%s\"\n"
+            "    .size pool, . - pool\n"
+            "    .section .note.GNU-stack,\"\",%%progbits\n",
+            binName);
+    fclose(file);
+    printf("* assembler file: %s\n", name);
+
+    snprintf(name, sizeof(name), "%.*s.h", baseLength(fileName), fileName);
+    fileOut = fopen(name, "w");
+    if (fileOut == NULL) {
+        printf("Can't open file: %s\n", name);
+        exit(-3);
+    }
+    fprintf(fileOut, "extern const unsigned char pool[];\n\n#define POOL_SIZE %d\n\n", pool_size);
+    if (compressPool)
+        fprintf(fileOut, "// pool is compressed, see lz.h\n#define POOL_COMPRESSED_SIZE %d\n\n",
+                compressed_size);
+    printList();
+    if (idMap != NULL)
+        printRemap();
+    fclose(fileOut);
+    printf("* header file: %s\n", name);
+}
+
+//
+// prints the compression ratio of a compressed pool file and how fast
+// it is decompressed
+//
+void unpacked(char *data, int length)
+{
+    (void) data;
+    (void) length;
+}
+
+void reportCompression(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+        return;
+    unsigned char *data = (unsigned char *) malloc(compressed_size + 1);
+    int length = fread(data, 1, compressed_size, file);
+    fclose(file);
+
+    // decompress until it has taken long enough to measure
+    int rounds = 0;
+    clock_t start = clock();
+    clock_t elapsed;
+    do {
+        if (unpack_pool(data, length, unpacked) != pool_size) {
+            printf("ERROR: compressed pool %s is corrupt!\n", fileName);
+            free(data);
+            return;
+        }
+        rounds++;
+        elapsed = clock() - start;
+    } while (elapsed < CLOCKS_PER_SEC / 5);
+    free(data);
+
+    double seconds = (double) elapsed / CLOCKS_PER_SEC;
+    printf("* compressed size: %d (%.1f %% of %d), decompression: %.0f MB/s\n",
+           compressed_size, 100.0 * compressed_size / (pool_size ? pool_size : 1), pool_size,
+           (double) pool_size * rounds / seconds / 1e6);
+}
+
+//
+// writes the manifest of the segments (out.h -> out.segments): one
+// line per segment with the segment number, file name, size, number
+// of objects and the names of its root level objects
+//
+void writeManifest(const char *fileName, void (*ready)(char *data, int length))
+{
+    char name[1024];
+    snprintf(name, sizeof(name), "%.*s.segments", baseLength(fileName), fileName);
+
+    FILE *manifest = fopen(name, "w");
+    if (manifest == NULL) {
+        printf("Can't open file: %s\n", name);
+        exit(-3);
+    }
+    fprintf(manifest, "# segment file size objects names\n");
+    for (int segment = 0; segment < get_segment_count(); segment++) {
+        char part[32];
+        char segmentName[1024];
+        snprintf(part, sizeof(part), "seg%d", segment);
+        fileNameWith(segmentName, sizeof(segmentName), fileName, part);
+        writePoolFile(fileName, NULL, segment, ready);
+        fprintf(manifest, "%d %s %d %d", segment, segmentName, pool_size, nro_total_objects);
+        for (node_t *node = list_start; node != NULL; node = node->tail)
+            if (get_segment_of(node->id) == segment)
+                fprintf(manifest, " %s", node->name);
+        fprintf(manifest, "\n");
+    }
+    fclose(manifest);
+    printf("* segment manifest: %s\n", name);
+}
+
 //
 // function for printing usage information on stdout
 //
 void printUseage()
 {
     printf("Usage: pooleditparser xml-filename output-filename -d=[dimension] "
-           "-sw=[softkey width] -sh=[softkey height] -c=[colors] [-table] [-v]\n");
+           "-sw=[softkey width] -sh=[softkey height] -c=[colors] [-table] [-v]\n"
+           "       [-cache=[picture cache directory]] [-max-size=[bytes]] [-languages]\n"
+           "       [-dedup] [-prune] [-macros] [-renumber[=[first id]]] [-segments]\n"
+           "       [-index] [-asm] [-compress] [-compile-ir]\n"
+           "       [-profile=[dimension],[sk width],[sk height],[colors]]...\n"
+           "       [-profiles=[profile file]] [-jobs=[processes]]\n"
+           "       [-pool-cache=[directory]] [-pool-cache-size=[bytes]]\n"
+           "       [-delta=[previous pool with index]] [-watch]\n"
+           "       [-document-cache=[directory]] [-include-root=[directory]]\n"
+           "       [-connect=[socket]] [-memfd]\n"
+           "   or: pooleditparser -daemon=[socket] [options]\n"
+           "   or: pooleditparser -batch=[manifest] [-jobs=[processes]] [options]\n");
 }
 
 //
-// main program
+// VT profile that a pool is generated for
 //
-int main(int argc, char *argv[])
+typedef struct
+{
+    int dimension;
+    int skWidth;
+    int skHeight;
+    int colors;
+    char name[32];
+} Profile;
+
+#define MAX_PROFILES 256
+Profile profiles[MAX_PROFILES];
+int nroProfiles = 0;
+
+// number of processes generating the pools of the profiles, 0 means
+// the number of processors
+int jobs = 0;
+
+//
+// replaces invalid VT parameters with the minimum or default values
+//
+void checkProfile(Profile *profile)
+{
+    if (profile->dimension < 200) {
+        printf("Too small dimension (%d), using 200\n", profile->dimension);
+        profile->dimension = 200;
+    }
+    if (profile->skWidth < 60) {
+        printf("Too small soft key width (%d), using 60\n", profile->skWidth);
+        profile->skWidth = 60;
+    }
+    if (profile->skHeight < 32) {
+        printf("Too small soft key height (%d), using 32\n", profile->skHeight);
+        profile->skHeight = 32;
+    }
+    if (profile->colors != 2 && profile->colors != 16 && profile->colors != 256) {
+        printf("Invalid number of colors (%d), using 256\n", profile->colors);
+        profile->colors = 256;
+    }
+}
+
+//
+// adds a profile to the list, returns false if the list is full
+//
+int addProfile(const char *name, int dimension, int skWidth, int skHeight, int colors)
+{
+    if (nroProfiles == MAX_PROFILES) {
+        printf("Too many profiles, max %d\n", MAX_PROFILES);
+        return false;
+    }
+    Profile *profile = &profiles[nroProfiles++];
+    profile->dimension = dimension;
+    profile->skWidth = skWidth;
+    profile->skHeight = skHeight;
+    profile->colors = colors;
+    checkProfile(profile);
+    if (name != NULL)
+        snprintf(profile->name, sizeof(profile->name), "%s", name);
+    else
+        snprintf(profile->name, sizeof(profile->name), "%d-%dx%d-%d", profile->dimension,
+                 profile->skWidth, profile->skHeight, profile->colors);
+    return true;
+}
+
+//
+// reads profiles from a file, one per line: [name] dimension soft key
+// width soft key height colors. Empty lines and lines starting with #
+// are skipped.
+//
+int readProfiles(const char *fileName)
+{
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL) {
+        printf("Can't open file: %s\n", fileName);
+        return false;
+    }
+    char line[256];
+    int lineNumber = 0;
+    int ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        char name[32];
+        int dimension, skWidth, skHeight, colors;
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0')
+            continue;
+        if (sscanf(text, "%d %d %d %d", &dimension, &skWidth, &skHeight, &colors) == 4)
+            ok = addProfile(NULL, dimension, skWidth, skHeight, colors);
+        else if (sscanf(text, "%31s %d %d %d %d", name, &dimension, &skWidth, &skHeight, &colors) == 5)
+            ok = addProfile(name, dimension, skWidth, skHeight, colors);
+        else {
+            printf("Invalid profile in %s line %d\n", fileName, lineNumber);
+            ok = false;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+//
+// forgets the results of the previous pool
+//
+void resetOutput()
+{
+    while (list_start != NULL) {
+        node_t *next = list_start->tail;
+        free(list_start->name);
+        free(list_start);
+        list_start = next;
+    }
+    list_end = NULL;
+    pool_size = 0;
+    nro_total_objects = 0;
+    nro_root_objects = 0;
+    compressed_size = 0;
+    depth = 0;
+    firstByte = true;
+    if (idMap != NULL)
+        for (int i = 0; i < 65536; i++)
+            idMap[i] = i;
+}
+
+//
+// Compiled pool cache. An entry has the header, the object directory,
+// the remapped ids (with -renumber), the root level object names and
+// the pool itself, so a pool can be written from a mapped entry
+// without parsing anything.
+//
+typedef struct
+{
+    pool_xform_t xform;
+    int poolSize;
+    int nroObjects;
+    int nroRootObjects;
+    int nroRemaps;
+    int nroNames;
+} PoolCacheHeader;
+
+//
+// returns the cache key of the input file (or IR) with a VT profile
+// and the options
+//
+unsigned long long poolKey(FILE *fileIn, const unsigned char *ir, int irLength,
+                           const Profile *profile)
+{
+    unsigned long long key = hashBytes(VERSION, strlen(VERSION), optionKey);
+    if (ir != NULL)
+        key = hashBytes(ir, irLength, key);
+    else {
+        char buffer[64 * 1024];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), fileIn)) > 0)
+            key = hashBytes(buffer, length, key);
+        rewind(fileIn);
+    }
+    key = hashInt(profile->dimension, key);
+    key = hashInt(profile->skWidth, key);
+    key = hashInt(profile->skHeight, key);
+    return hashInt(profile->colors, key);
+}
+
+//
+// stores a compiled pool and the current name list in the cache, ext
+// tells if it is a pool or a fragment
+//
+void storePool(const char *ext, unsigned long long key, const pool_image_t *image)
+{
+    PoolCacheHeader header;
+    header.xform = *get_pool_xform();
+    header.poolSize = image->size;
+    header.nroObjects = image->nro_entries;
+    header.nroRootObjects = nro_root_objects;
+    header.nroRemaps = 0;
+    header.nroNames = 0;
+
+    int namesSize = 0;
+    for (int i = 0; idMap != NULL && i < 65536; i++)
+        if (idMap[i] != i)
+            header.nroRemaps++;
+    for (node_t *node = list_start; node != NULL; node = node->tail) {
+        namesSize += sizeof(int) + strlen(node->name) + 1;
+        header.nroNames++;
+    }
+
+    int directorySize = image->nro_entries * sizeof(pool_entry_t);
+    int remapSize = header.nroRemaps * 2 * sizeof(int);
+    int length = sizeof(header) + directorySize + remapSize + namesSize + image->size;
+    char *entry = (char *) malloc(length);
+    char *ptr = entry;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    memcpy(ptr, image->directory, directorySize);
+    ptr += directorySize;
+    for (int i = 0; idMap != NULL && i < 65536; i++) {
+        if (idMap[i] != i) {
+            int remap[2] = {i, idMap[i]};
+            memcpy(ptr, remap, sizeof(remap));
+            ptr += sizeof(remap);
+        }
+    }
+    for (node_t *node = list_start; node != NULL; node = node->tail) {
+        memcpy(ptr, &node->id, sizeof(int));
+        ptr += sizeof(int);
+        strcpy(ptr, node->name);
+        ptr += strlen(node->name) + 1;
+    }
+    memcpy(ptr, image->data, image->size);
+
+    // room is made for the new entry first, so it is never evicted
+    cacheEvict(poolCacheDir, ext, poolCacheSize - length);
+    if (cacheStore(poolCacheDir, ext, key, entry, length) != 0)
+        printf("WARNING: can't write pool cache in %s\n", poolCacheDir);
+    free(entry);
+}
+
+//
+// reads a mapped cache entry: image points to the pool in the entry,
+// and the name list, id map and counts are restored. Returns false if
+// the entry is not valid.
+//
+int loadPool(const char *entry, int length, pool_image_t *image, pool_xform_t *xform)
+{
+    PoolCacheHeader header;
+    if (length < (int) sizeof(header))
+        return false;
+    memcpy(&header, entry, sizeof(header));
+    long long needed = sizeof(header) + (long long) header.nroObjects * sizeof(pool_entry_t)
+        + (long long) header.nroRemaps * 2 * sizeof(int) + header.poolSize;
+    if (header.nroObjects < 0 || header.nroRemaps < 0 || header.nroNames < 0 ||
+        header.poolSize < 0 || needed > length)
+        return false;
+
+    const char *ptr = entry + sizeof(header);
+    image->directory = (pool_entry_t *) ptr;
+    image->nro_entries = header.nroObjects;
+    ptr += header.nroObjects * sizeof(pool_entry_t);
+    for (int i = 0; i < header.nroRemaps; i++) {
+        int remap[2];
+        memcpy(remap, ptr, sizeof(remap));
+        ptr += sizeof(remap);
+        if (idMap != NULL && remap[0] >= 0 && remap[0] < 65536)
+            idMap[remap[0]] = remap[1];
+    }
+    const char *end = entry + length - header.poolSize;
+    for (int i = 0; i < header.nroNames; i++) {
+        int id;
+        if (end - ptr < (int) sizeof(int) + 1)
+            return false;
+        memcpy(&id, ptr, sizeof(int));
+        ptr += sizeof(int);
+        int nameLength = strnlen(ptr, end - ptr);
+        if (nameLength == end - ptr)
+            return false;
+        addToList(strdup(ptr), id);
+        ptr += nameLength + 1;
+    }
+    image->data = (unsigned char *) end;
+    image->size = header.poolSize;
+    for (int i = 0; i < image->nro_entries; i++)
+        if (image->directory[i].offset < 0 || image->directory[i].size < 0 ||
+            image->directory[i].offset + image->directory[i].size > image->size)
+            return false;
+
+    *xform = header.xform;
+    nro_root_objects = header.nroRootObjects;
+    return true;
+}
+
+//
+// passes the objects of a pool image to the output like the parser
+// does: to the outermost sink, or to ready() with -table and -python
+//
+void writeImage(const pool_image_t *image, pool_sink_t *out, void (*ready)(char *data, int length))
+{
+    pool_span_t spans[256];
+    int count = 0;
+    for (int i = 0; i < image->nro_entries; i++) {
+        char *data = (char *) image->data + image->directory[i].offset;
+        int size = image->directory[i].size;
+        if (out == NULL) {
+            ready(data, size);
+            continue;
+        }
+        spans[count].data = data;
+        spans[count].length = size;
+        count++;
+        out->size += size;
+        out->objects++;
+        if (count == 256) {
+            out->write(out, spans, count);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        out->write(out, spans, count);
+}
+
+//
+// returns the IR of the XML file from the document cache, converting
+// and storing it first if it isn't there. Release it with
+// cacheUnmap(). Returns NULL if the file can't be converted.
+//
+const unsigned char *loadDocument(FILE *fileIn, int *length)
+{
+    unsigned long long key = hashBytes(VERSION, strlen(VERSION), HASH_SEED);
+    char buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fileIn)) > 0)
+        key = hashBytes(buffer, n, key);
+    rewind(fileIn);
+
+    const void *entry = cacheMap(documentCacheDir, "pir", key, length);
+    if (entry != NULL)
+        return (const unsigned char *) entry;
+
+    unsigned char *ir = compile_ir_buffer(fileIn, length);
+    if (ir == NULL)
+        return NULL;
+    cacheEvict(documentCacheDir, "pir", poolCacheSize - *length);
+    if (cacheStore(documentCacheDir, "pir", key, ir, *length) != 0)
+        printf("WARNING: can't write document cache in %s\n", documentCacheDir);
+    free(ir);
+    entry = cacheMap(documentCacheDir, "pir", key, length);
+    if (entry == NULL)
+        printf("ERROR: can't read document cache in %s\n", documentCacheDir);
+    return (const unsigned char *) entry;
+}
+
+//
+// adds a fragment file name found in the input, once
+//
+void addFragmentFile(const char *file, int length)
+{
+    for (int i = 0; i < nroFragments; i++)
+        if ((int) strlen(fragments[i].file) == length && strncmp(fragments[i].file, file, length) == 0)
+            return;
+    if (nroFragments == MAX_FRAGMENTS) {
+        printf("ERROR: too many fragments, the maximum is %d\n", MAX_FRAGMENTS);
+        exit(-1);
+    }
+    Fragment *fragment = &fragments[nroFragments++];
+    memset(fragment, 0, sizeof(Fragment));
+    fragment->file = (char *) malloc(length + 1);
+    memcpy(fragment->file, file, length);
+    fragment->file[length] = '\0';
+}
+
+int fragmentDepth;
+
+//
+// callback function of replayIr(), finds the fragments of an IR input
+//
+void fragmentStart(void *data, const char *el, const char **attr)
+{
+    (void) data;
+    const char *file = getAttribute(attr, "file");
+    if (fragmentDepth == 1 && strcmp(el, "include_fragment") == 0 && file != NULL)
+        addFragmentFile(file, strlen(file));
+    fragmentDepth++;
+}
+
+void fragmentEnd(void *data, const char *el)
+{
+    (void) data;
+    (void) el;
+    fragmentDepth--;
+}
+
+void fragmentPixels(const unsigned char *data, int length)
+{
+    (void) data;
+    (void) length;
+}
+
+//
+// finds the include_fragment elements of the input
+//
+void findFragments(FILE *fileIn, const unsigned char *ir, int irLength)
+{
+    if (ir != NULL) {
+        fragmentDepth = 0;
+        replayIr(ir, irLength, fragmentStart, fragmentEnd, fragmentPixels);
+        return;
+    }
+
+    int length = 0;
+    int capacity = 64 * 1024;
+    char *xml = (char *) malloc(capacity + 1);
+    int n;
+    while ((n = fread(xml + length, 1, capacity - length, fileIn)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            xml = (char *) realloc(xml, capacity + 1);
+        }
+    }
+    xml[length] = '\0';
+    rewind(fileIn);
+
+    int headerLength;
+    RootSlice *slices = NULL;
+    int count = strstr(xml, "<include_fragment") ? splitRoots(xml, length, &headerLength, &slices) : 0;
+    for (int i = 0; i < count; i++) {
+        const char *tag = xml + slices[i].start;
+        if (strncmp(tag, "<include_fragment", 17) != 0 || isalnum((unsigned char) tag[17]) || tag[17] == '_')
+            continue;
+        const char *end = tag + slices[i].length;
+        for (const char *ptr = tag + 17; ptr + 6 < end; ptr++) {
+            if (strncmp(ptr, "file", 4) != 0 || !isspace((unsigned char) ptr[-1]))
+                continue;
+            const char *value = ptr + 4 + strspn(ptr + 4, " \t\r\n");
+            if (*value != '=')
+                continue;
+            value += 1 + strspn(value + 1, " \t\r\n");
+            const char *close = (*value == '"' || *value == '\'') ? strchr(value + 1, *value) : NULL;
+            if (close != NULL && close < end)
+                addFragmentFile(value + 1, close - value - 1);
+            break;
+        }
+    }
+    free(slices);
+    free(xml);
+}
+
+//
+// compiles the fragments the input includes for the VT profile, or
+// maps them from the pool cache. A fragment is compiled on its own,
+// without the whole pool options, and its file name is relative to
+// the input file.
+//
+void prepareFragments(const char *inputName, FILE *fileIn, const unsigned char *ir, int irLength,
+                      const Profile *profile)
+{
+    findFragments(fileIn, ir, irLength);
+    for (int i = 0; i < nroFragments; i++) {
+        Fragment *fragment = &fragments[i];
+        char path[1024];
+        const char *slash = strrchr(inputName, '/');
+        if (fragment->file[0] == '/' || slash == NULL)
+            snprintf(path, sizeof(path), "%s", fragment->file);
+        else
+            snprintf(path, sizeof(path), "%.*s%s", (int) (slash - inputName + 1), inputName, fragment->file);
+        if (includeRoot != NULL && !inDirectory(path, includeRoot)) {
+            printf("ERROR: fragment %s is not in %s\n", path, includeRoot);
+            exit(-2);
+        }
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            printf("Can't open file: %s\n", path);
+            exit(-2);
+        }
+
+        // the whole pool options are not used for fragments
+        unsigned long long savedKey = optionKey;
+        optionKey = HASH_SEED;
+        fragment->key = poolKey(file, NULL, 0, profile);
+        optionKey = savedKey;
+
+        resetOutput();
+        pool_xform_t xform;
+        if (poolCacheDir != NULL)
+            fragment->entry = cacheMap(poolCacheDir, "frag", fragment->key, &fragment->entryLength);
+        if (fragment->entry != NULL &&
+            loadPool((const char *) fragment->entry, fragment->entryLength, &fragment->image, &xform))
+            printf("* fragment: %s (cached)\n", path);
+        else {
+            cacheUnmap(fragment->entry, fragment->entryLength);
+            fragment->entry = NULL;
+            resetOutput();
+
+            pool_sink_t *memorySink = open_memory_sink();
+            set_output_sink(memorySink);
+            compilingFragment = true;
+            parse_fragment(file, starts, ends, NULL, profile->dimension,
+                           profile->skWidth, profile->skHeight, profile->colors);
+            compilingFragment = false;
+            set_output_sink(NULL);
+            fragment->compiled = close_memory_sink(memorySink);
+            fragment->image = *fragment->compiled;
+            if (poolCacheDir != NULL)
+                storePool("frag", fragment->key, fragment->compiled);
+            printf("* fragment: %s (compiled)\n", path);
+        }
+        fclose(file);
+
+        fragment->names = list_start;
+        fragment->nroRootObjects = nro_root_objects;
+        list_start = NULL;
+        list_end = NULL;
+    }
+    resetOutput();
+}
+
+//
+// releases the fragments of the last pool
+//
+void freeFragments()
+{
+    for (int i = 0; i < nroFragments; i++) {
+        Fragment *fragment = &fragments[i];
+        if (fragment->compiled != NULL)
+            free_pool_image(fragment->compiled);
+        else
+            cacheUnmap(fragment->entry, fragment->entryLength);
+        while (fragment->names != NULL) {
+            node_t *next = fragment->names->tail;
+            free(fragment->names->name);
+            free(fragment->names);
+            fragment->names = next;
+        }
+        free(fragment->file);
+    }
+    nroFragments = 0;
+}
+
+//
+// generates the pool for one VT profile from XML file or IR and writes
+// it to outputArg (and the other output files). Returns 0, -5 if the
+// pool doesn't fit in the -max-size budget, or -6 if it couldn't be
+// renumbered.
+//
+int compilePool(const char *inputName, FILE *fileIn, const unsigned char *ir, int irLength,
+                 const char *outputArg, Profile *profile)
+{
+    resetOutput();
+
+    // with -asm the pool is written in binary format to out.bin, and
+    // out.s and out.h refer to it
+    char binName[1024];
+    const char *outputName = outputArg;
+    if (asmOutput) {
+        if (printTable || pythonTable) {
+            printf("-asm can't be used with -table or -python\n");
+            exit(-1);
+        }
+        snprintf(binName, sizeof(binName), "%.*s.bin", baseLength(outputArg), outputArg);
+        outputName = binName;
+    }
+
+    if (sharedPool) {
+        fileOut = openSharedPool();
+        if (fileOut == NULL)
+            exit(-3);
+    }
+    else {
+        fileOut = fopen(outputName, "w");
+        if (fileOut == NULL) {
+            printf("Can't open file: %s\n", outputName);
+            exit(-3);
+        }
+    }
+
+    // print settings
+    printf(
+           "***************************************************\n"
+           "* Parsing: %s to %s\n"
+           "* dimension: %i\n"
+           "* softkey size: %ix%i\n"
+           "* colors: %i\n",
+           inputName, outputArg, profile->dimension, profile->skWidth,
+           profile->skHeight, profile->colors);
+
+    // the fragments are compiled before the pool, and the pool is
+    // cached by them too
+    prepareFragments(inputName, fileIn, ir, irLength, profile);
+    unsigned long long fragmentsKey = HASH_SEED;
+    for (int i = 0; i < nroFragments; i++)
+        fragmentsKey = hashBytes(&fragments[i].key, sizeof(fragments[i].key), fragmentsKey);
+
+    // the binary format is written by the sink
+    void (*ready)(char *data, int length) = NULL;
+    if (printTable)
+        ready = ascii_ready;
+    else if (pythonTable)
+        ready = python_ready;
+    initByteText();
+
+    // with the pool cache the pool is compiled to memory, or mapped
+    // from the cache if the same input was compiled before with the
+    // same profile and options
+    int useCache = poolCacheDir != NULL && !languagePools && !segments;
+    pool_xform_t xform;
+    pool_image_t cachedImage;
+    pool_image_t *image = NULL;
+    const void *entry = NULL;
+    int entryLength = 0;
+
+    // in watch mode only the root level objects that changed since the
+    // previous compile are parsed. Documents that use the multiplier
+    // attribute and options that work on the whole pool are compiled
+    // normally.
+    if (watchMode && ir == NULL && optionKey == HASH_SEED && !languagePools && !segments &&
+        nroFragments == 0) {
+        WatchStats watchStats;
+        clock_t start = clock();
+        image = compileRoots(fileIn, profile->dimension, profile->skWidth,
+                             profile->skHeight, profile->colors, addRoot, &watchStats);
+        if (image != NULL)
+            printf("* watch: %d of %d root level objects compiled (%.3f s)\n",
+                   watchStats.compiled, watchStats.roots,
+                   (double) (clock() - start) / CLOCKS_PER_SEC);
+    }
+
+    if (useCache && image == NULL) {
+        unsigned long long key = poolKey(fileIn, ir, irLength, profile);
+        if (nroFragments > 0)
+            key = hashBytes(&fragmentsKey, sizeof(fragmentsKey), key);
+        entry = cacheMap(poolCacheDir, "pool", key, &entryLength);
+        if (entry != NULL && loadPool((const char *) entry, entryLength, &cachedImage, &xform)) {
+            image = &cachedImage;
+            printf("* pool cache hit: %016llx\n", key);
+        }
+        else {
+            cacheUnmap(entry, entryLength);
+            entry = NULL;
+            resetOutput();
+
+            pool_sink_t *memorySink = open_memory_sink();
+            set_output_sink(memorySink);
+            if (ir != NULL)
+                parse_ir(ir, irLength, starts, ends, ready, profile->dimension,
+                         profile->skWidth, profile->skHeight, profile->colors);
+            else
+                parse(fileIn, starts, ends, ready, profile->dimension,
+                      profile->skWidth, profile->skHeight, profile->colors);
+            set_output_sink(NULL);
+            image = close_memory_sink(memorySink);
+            if (!get_pool_stats()->renumber_failed)
+                storePool("pool", key, image);
+        }
+    }
+
+    writeHeader();
+
+    // with -delta only the objects that are new or changed since the
+    // previous pool are written, the manifest lists them and the
+    // deleted ids (out.dat -> out.delta)
+    pool_sink_t *deltaSink = NULL;
+    if (deltaEntries != NULL && sink == NULL)
+        printf("WARNING: -delta is only supported for the binary format\n");
+    else if (deltaEntries != NULL) {
+        deltaSink = open_delta_sink(compressSink ? compressSink : sink, deltaEntries, deltaCount);
+        set_output_sink(deltaSink);
+    }
+
+    // the index of the binary pool is written next to it (out.dat ->
+    // out.idx) when the file is complete. With -delta it still has every
+    // object of the pool, so it can be the base of the next delta. With
+    // -memfd the index goes to the memory file after the pool.
+    pool_sink_t *indexSink = NULL;
+    if (writeIndex && sink == NULL)
+        printf("WARNING: -index is only supported for the binary format\n");
+    else if (writeIndex || sharedPool) {
+        indexSink = open_index_sink(deltaSink ? deltaSink : compressSink ? compressSink : sink);
+        set_output_sink(indexSink);
+    }
+
+    if (image != NULL) {
+        pool_sink_t *out = indexSink ? indexSink : deltaSink ? deltaSink : compressSink ? compressSink : sink;
+        writeImage(image, out, ready);
+    }
+    else if (ir != NULL)
+        parse_ir(ir, irLength, starts, ends, ready, profile->dimension,
+                 profile->skWidth, profile->skHeight, profile->colors);
+    else
+        parse(fileIn, starts, ends, ready, profile->dimension,
+              profile->skWidth, profile->skHeight, profile->colors);
+    if (languagePools || segments)
+        emit_pool(NULL, ready);
+
+    if (deltaSink != NULL) {
+        char deltaName[1024];
+        DeltaCounts counts;
+        snprintf(deltaName, sizeof(deltaName), "%.*s.delta", baseLength(outputName), outputName);
+        if (!close_delta_sink(deltaSink, deltaName, &counts)) {
+            printf("Can't write file: %s\n", deltaName);
+            exit(-3);
+        }
+        printf("* delta: %d added, %d changed, %d unchanged, %d deleted (%s)\n",
+               counts.added, counts.changed, counts.unchanged, counts.deleted, deltaName);
+    }
+    writeFooter();
+
+    if (indexSink != NULL && !sharedPool) {
+        char indexName[1024];
+        fflush(fileOut);
+        unsigned int fileSize = ftell(fileOut);
+        snprintf(indexName, sizeof(indexName), "%.*s.idx", baseLength(outputName), outputName);
+        if (!close_index_sink(indexSink, indexName, fileSize)) {
+            printf("Can't write file: %s\n", indexName);
+            exit(-3);
+        }
+        printf("* index: %s\n", indexName);
+    }
+
+    if (sharedPool) {
+        if (!sendSharedPool(fileOut, indexSink, outputArg))
+            exit(-3);
+        printf("* pool sent in a memory file to %s\n", outputArg);
+    }
+    else
+        fclose(fileOut);
+
+    freeFragments();
+    if (entry != NULL)
+        cacheUnmap(entry, entryLength);
+    else if (image != NULL) {
+        xform = *get_pool_xform();
+        free_pool_image(image);
+    }
+    else
+        xform = *get_pool_xform();
+
+    if (compressPool)
+        reportCompression(outputName);
+    if (asmOutput)
+        writeAsm(outputArg, outputName);
+
+    // write the pool of every language and every segment to its own
+    // file
+    if (languagePools || segments) {
+        int default_pool_size = pool_size;
+        int default_total_objects = nro_total_objects;
+        for (int i = 0; languagePools && i < get_language_count(); i++) {
+            writePoolFile(outputName, get_language_code(i), -1, ready);
+            for (int j = 0; j < get_segment_count(); j++)
+                writePoolFile(outputName, get_language_code(i), j, ready);
+        }
+        if (segments)
+            writeManifest(outputName, ready);
+        free_pool();
+        pool_size = default_pool_size;
+        nro_total_objects = default_total_objects;
+    }
+
+    // print statistics
+    printf("* dmMultiplier: %f\n"
+           "* skMultiplier: %f\n"
+           "* dmDeltaX: %d\n"
+           "* dmDeltaY: %d\n"
+           "* skDeltaX: %d\n"
+           "* skDeltaY: %d\n"
+           "* generated pool size: %d\n"
+           "* total number of objects: %d\n"
+           "* number of root level objects: %d\n"
+           "***************************************************\n",
+           xform.dm_mult, xform.sk_mult,
+           xform.dm_dx, xform.dm_dy, xform.sk_dx, xform.sk_dy,
+           pool_size, nro_total_objects, nro_root_objects);
+
+    int result = (maxSize > 0 && pool_size > maxSize) ? -5 : 0;
+    if (entry == NULL && get_pool_stats()->renumber_failed)
+        result = -6;
+
+    // nothing was compiled on a cache hit
+    if (entry != NULL)
+        return result;
+
+    pool_stats_t *stats = get_pool_stats();
+    if (stats->picture_cache_hits + stats->picture_cache_misses > 0) {
+        printf("* picture cache hits: %d\n"
+               "* picture cache misses: %d\n"
+               "***************************************************\n",
+               stats->picture_cache_hits, stats->picture_cache_misses);
+    }
+    if (stats->nro_commands_removed > 0 || stats->nro_macros_merged > 0) {
+        printf("* removed macro commands: %d, merged macros: %d (%d bytes saved)\n",
+               stats->nro_commands_removed, stats->nro_macros_merged, stats->macro_bytes);
+    }
+    if (stats->nro_deduplicated > 0) {
+        printf("* deduplicated objects: %d (%d bytes saved)\n",
+               stats->nro_deduplicated, stats->deduplicated_bytes);
+    }
+    if (stats->nro_removed > 0) {
+        printf("* removed unreferenced objects: %d (%d bytes saved)\n",
+               stats->nro_removed, stats->removed_bytes);
+    }
+    for (int i = 0; i < stats->nro_degraded; i++) {
+        pool_degrade_t *d = &stats->degraded[i];
+        printf("* degraded picture %d: %d -> %d bytes (%dx%d, %d colors%s)\n",
+               d->object_id, d->old_size, d->new_size, d->width, d->height,
+               d->colors, d->rle ? ", rle" : "");
+    }
+    if (maxSize > 0) {
+        printf("* pool size budget: %d (%s)\n"
+               "***************************************************\n",
+               maxSize, pool_size <= maxSize ? "fits" : "DOES NOT FIT");
+    }
+    return result;
+}
+
+//
+// generates the pools of all profiles from the IR, each to its own
+// output file (out.dat -> out.<profile name>.dat). The profiles are
+// divided between processes, so they are generated in parallel.
+//
+int compileProfiles(const char *inputName, const unsigned char *ir, int irLength,
+                    const char *outputArg)
+{
+    int workers = jobs;
+#ifdef _WIN32
+    workers = 1;
+#else
+    if (workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (workers > nroProfiles)
+        workers = nroProfiles;
+    if (workers < 1)
+        workers = 1;
+
+    char name[1024];
+    int result = 0;
+    if (workers == 1) {
+        for (int i = 0; i < nroProfiles; i++) {
+            fileNameWith(name, sizeof(name), outputArg, profiles[i].name);
+            int status = compilePool(inputName, NULL, ir, irLength, name, &profiles[i]);
+            if (status != 0)
+                result = status;
+        }
+        return result;
+    }
+
+#ifndef _WIN32
+    // the output of a profile is printed at once, not mixed with the
+    // output of the other processes
+    fflush(stdout);
+    pid_t *pids = (pid_t *) malloc(workers * sizeof(pid_t));
+    for (int worker = 0; worker < workers; worker++) {
+        pids[worker] = fork();
+        if (pids[worker] < 0) {
+            printf("Can't start process: %s\n", strerror(errno));
+            exit(-4);
+        }
+        if (pids[worker] == 0) {
+            setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+            for (int i = worker; i < nroProfiles; i += workers) {
+                fileNameWith(name, sizeof(name), outputArg, profiles[i].name);
+                int status = compilePool(inputName, NULL, ir, irLength, name, &profiles[i]);
+                if (status != 0)
+                    result = status;
+                fflush(stdout);
+            }
+            exit(result);
+        }
+    }
+
+    int failed = 0;
+    for (int worker = 0; worker < workers; worker++) {
+        int status;
+        if (waitpid(pids[worker], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    free(pids);
+    if (failed > 0) {
+        printf("ERROR: %d of %d processes failed\n", failed, workers);
+        return -4;
+    }
+#endif
+    return 0;
+}
+
+//
+// compiles the opened input file to the output file. The input can
+// also be an IR file made with -compile-ir, and with several profiles
+// the XML is converted to IR once.
+//
+int compileInput(const char *inputName, FILE *fileIn, const char *outputArg, Profile *profile)
+{
+    int result;
+    int irLength = 0;
+    const unsigned char *ir = open_ir(fileIn, &irLength);
+    const unsigned char *document = NULL;
+    if (ir == NULL && documentCacheDir != NULL && !watchMode) {
+        document = loadDocument(fileIn, &irLength);
+        if (document == NULL)
+            exit(-1);
+    }
+    if (document != NULL && nroProfiles > 0)
+        result = compileProfiles(inputName, document, irLength, outputArg);
+    else if (document != NULL)
+        result = compilePool(inputName, NULL, document, irLength, outputArg, profile);
+    else if (nroProfiles > 0) {
+        unsigned char *compiled = NULL;
+        if (ir == NULL) {
+            compiled = compile_ir_buffer(fileIn, &irLength);
+            if (compiled == NULL)
+                exit(-1);
+        }
+        result = compileProfiles(inputName, ir ? ir : compiled, irLength, outputArg);
+        free(compiled);
+    }
+    else
+        result = compilePool(inputName, fileIn, ir, irLength, outputArg, profile);
+
+    if (ir != NULL)
+        close_ir(ir, irLength);
+    if (document != NULL)
+        cacheUnmap(document, irLength);
+    return result;
+}
+
+//
+// in watch mode the input is compiled by a process of its own, because
+// the parser exits on errors. The root level objects it compiled are
+// sent back through a pipe for the next compile, and an error is
+// reported and the input is watched again.
+//
+int compileWatched(const char *inputName, FILE *fileIn, const char *outputArg, Profile *profile)
+{
+#ifdef _WIN32
+    return compileInput(inputName, fileIn, outputArg, profile);
+#else
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("Can't create pipe: %s\n", strerror(errno));
+        exit(-4);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("Can't start process: %s\n", strerror(errno));
+        exit(-4);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int result = compileInput(inputName, fileIn, outputArg, profile);
+        FILE *out = fdopen(fds[1], "wb");
+        writeRoots(out);
+        fclose(out);
+        exit(result);
+    }
+
+    // the results are read before waiting, the pipe can't hold them all
+    close(fds[1]);
+    FILE *in = fdopen(fds[0], "rb");
+    readRoots(in);
+    fclose(in);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        printf("ERROR: %s was not compiled\n", inputName);
+        return -4;
+    }
+    int result = (signed char) WEXITSTATUS(status);
+    if (result == -1)
+        printf("ERROR: %s was not compiled\n", inputName);
+    return result;
+#endif
+}
+
+//
+// compiles the input file to the output file with the options of the
+// command line
+//
+int runParser(int argc, char *argv[])
 {
     // input file handle
     FILE *fileIn;
 
+    // previous pool with -delta
+    const char *deltaBase = NULL;
+
     // setting defaults
     int dimension = 200;
     int skWidth = 60;
@@ -229,17 +1632,14 @@ int main(int argc, char *argv[])
     }
 
     // open files
-    fileIn = fopen(argv[1], "r");
+    fileIn = fopen(argv[1], "rb");
     if (fileIn == NULL) {
         printf("Can't open file: %s\n", argv[1]);
         exit(-2);
     }
 
-    fileOut = fopen(argv[2], "w");
-    if (fileOut == NULL) {
-        printf("Can't open file: %s\n", argv[2]);
-        exit(-3);
-    }
+    set_remap_function(remapList);
+    set_fragment_function(fragmentObjects);
 
     // evaluate other arguments
     for (int i = 3; i < argc; i++) {
@@ -259,81 +1659,230 @@ int main(int argc, char *argv[])
             strtok(argv[i], "=");
             colors = atoi(strtok(NULL, "="));
         }
+        else if (strncmp("-delta=", argv[i], 7) == 0) {
+            deltaBase = argv[i] + 7;
+        }
+        else if (strncmp("-pool-cache=", argv[i], 12) == 0) {
+            poolCacheDir = argv[i] + 12;
+        }
+        else if (strncmp("-pool-cache-size=", argv[i], 17) == 0) {
+            poolCacheSize = atoll(argv[i] + 17);
+        }
+        else if (strncmp("-document-cache=", argv[i], 16) == 0) {
+            documentCacheDir = argv[i] + 16;
+        }
+        else if (strncmp("-cache=", argv[i], 7) == 0) {
+            set_picture_cache(argv[i] + 7);
+        }
+        else if (strncmp("-include-root=", argv[i], 14) == 0) {
+            includeRoot = argv[i] + 14;
+        }
+        else if (strncmp("-max-size=", argv[i], 10) == 0) {
+            optionKey = hashBytes(argv[i], strlen(argv[i]), optionKey);
+            strtok(argv[i], "=");
+            maxSize = atoi(strtok(NULL, "="));
+            set_max_pool_size(maxSize);
+        }
+        else if (strncmp("-languages", argv[i], 10) == 0) {
+            languagePools = true;
+            set_multi_language(true);
+        }
+        else if (strncmp("-index", argv[i], 6) == 0) {
+            writeIndex = true;
+        }
+        else if (strncmp("-segments", argv[i], 9) == 0) {
+            segments = true;
+            set_segments(true);
+        }
+        else if (strncmp("-prune", argv[i], 6) == 0) {
+            optionKey = hashBytes(argv[i], strlen(argv[i]), optionKey);
+            set_prune(true);
+        }
+        else if (strncmp("-dedup", argv[i], 6) == 0) {
+            optionKey = hashBytes(argv[i], strlen(argv[i]), optionKey);
+            set_deduplicate(true);
+        }
+        else if (strncmp("-macros", argv[i], 7) == 0) {
+            optionKey = hashBytes(argv[i], strlen(argv[i]), optionKey);
+            set_optimize_macros(true);
+        }
+        else if (strncmp("-renumber", argv[i], 9) == 0) {
+            optionKey = hashBytes(argv[i], strlen(argv[i]), optionKey);
+            int base = 0;
+            if (argv[i][9] == '=')
+                base = atoi(argv[i] + 10);
+            if (base < 0 || base >= 65535) {
+                printf("ERROR: -renumber needs a first id from 0 to 65534\n");
+                exit(-1);
+            }
+            set_renumber(base);
+            idMap = (int *) malloc(65536 * sizeof(int));
+            for (int j = 0; j < 65536; j++)
+                idMap[j] = j;
+        }
         else if (strncmp("-table", argv[i], 6) == 0) {
             printTable = true;
         }
         else if (strncmp("-python", argv[i], 6) == 0) {
             pythonTable = true;
         }
+        else if (strncmp("-profile=", argv[i], 9) == 0) {
+            int d, sw, sh, c;
+            if (sscanf(argv[i] + 9, "%d,%d,%d,%d", &d, &sw, &sh, &c) != 4) {
+                printUseage();
+                exit(-1);
+            }
+            if (!addProfile(NULL, d, sw, sh, c))
+                exit(-1);
+        }
+        else if (strncmp("-profiles=", argv[i], 10) == 0) {
+            if (!readProfiles(argv[i] + 10))
+                exit(-1);
+        }
+        else if (strcmp("-memfd", argv[i]) == 0) {
+            sharedPool = true;
+        }
+        else if (strcmp("-watch", argv[i]) == 0) {
+            watchMode = true;
+        }
+        else if (strncmp("-jobs=", argv[i], 6) == 0) {
+            jobs = atoi(argv[i] + 6);
+        }
+        else if (strncmp("-compile-ir", argv[i], 11) == 0) {
+            compileIr = true;
+        }
+        else if (strncmp("-compress", argv[i], 9) == 0) {
+            compressPool = true;
+        }
+        else if (strncmp("-asm", argv[i], 4) == 0) {
+            asmOutput = true;
+        }
         else {
             printUseage();
             exit(-1);
         }
     }
 
-    // sanity checks for arguments
-    if (dimension < 200) {
-        printf("Too small dimension (%d), using 200\n", dimension);
-        dimension = 200;
-    }
-    if (skWidth < 60) {
-        printf("Too small soft key width (%d), using 60\n", skWidth);
-        skWidth = 60;
-    }
-    if (skHeight < 32) {
-        printf("Too small soft key height (%d), using 32\n", skHeight);
-        skHeight = 32;
-    }
-    if (colors != 2 && colors != 16 && colors != 256) {
-        printf("Invalid number of colors (%d), using 256\n", colors);
-        colors = 256;
+    // the previous pool must have an index (prev.dat -> prev.idx)
+    if (deltaBase != NULL) {
+        char indexName[1024];
+        unsigned int fileSize;
+        snprintf(indexName, sizeof(indexName), "%.*s.idx", baseLength(deltaBase), deltaBase);
+        deltaEntries = readIndex(indexName, &deltaCount, &fileSize);
+        if (deltaEntries == NULL) {
+            printf("Can't read index: %s (write it with -index)\n", indexName);
+            exit(-2);
+        }
+        FILE *previous = fopen(deltaBase, "rb");
+        if (previous == NULL) {
+            printf("Can't open file: %s\n", deltaBase);
+            exit(-2);
+        }
+        fseek(previous, 0, SEEK_END);
+        long previousSize = ftell(previous);
+        fclose(previous);
+        if (previousSize != (long) fileSize) {
+            printf("ERROR: %s is not the index of %s\n", indexName, deltaBase);
+            exit(-2);
+        }
     }
 
-    // print settings
-    printf(
-           "***************************************************\n"
-           "* Parsing: %s to %s\n"
-           "* dimension: %i\n"
-           "* softkey size: %ix%i\n"
-           "* colors: %i\n",
-           argv[1], argv[2], dimension, skWidth, skHeight, colors);
+    Profile profile;
+    profile.dimension = dimension;
+    profile.skWidth = skWidth;
+    profile.skHeight = skHeight;
+    profile.colors = colors;
+    profile.name[0] = '\0';
+    checkProfile(&profile);
 
-    if (printTable) {
-        fprintf(fileOut, "unsigned char *pool = {\n");
-        parse(fileIn, starts, ends, ascii_ready, dimension, skWidth, skHeight, colors);
-        fprintf(fileOut, "\n};\n\n#define POOL_SIZE %d\n\n", pool_size);
-        printList();
+    if (compileIr) {
+        FILE *out = fopen(argv[2], "wb");
+        if (out == NULL) {
+            printf("Can't open file: %s\n", argv[2]);
+            exit(-3);
+        }
+        clock_t start = clock();
+        int ok = compile_ir(fileIn, out);
+        ok = (fclose(out) == 0) && ok;
+        fclose(fileIn);
+        if (!ok) {
+            printf("Can't compile %s to %s\n", argv[1], argv[2]);
+            exit(-3);
+        }
+        printf("* compiled %s to %s (%.3f s)\n", argv[1], argv[2],
+               (double) (clock() - start) / CLOCKS_PER_SEC);
+        return 0;
     }
-    else if (pythonTable) {
-        fprintf(fileOut, "pool = [\n");
-        parse(fileIn, starts, ends, python_ready, dimension, skWidth, skHeight, colors);
-        fprintf(fileOut, "\n]\n\nPOOL_SIZE = %d\n\n", pool_size);
-        pythonList();
+
+    if (compressPool && (printTable || pythonTable)) {
+        printf("-compress can't be used with -table or -python\n");
+        exit(-1);
     }
-    else {
-        parse(fileIn, starts, ends, binary_ready, dimension, skWidth, skHeight, colors);
+    if (sharedPool && (printTable || pythonTable || asmOutput || compressPool ||
+                       deltaBase != NULL || languagePools || segments || nroProfiles > 0)) {
+        printf("-memfd can only be used for one binary pool\n");
+        exit(-1);
     }
+    if (poolCacheDir != NULL && (languagePools || segments))
+        printf("WARNING: -pool-cache is not used with -languages or -segments\n");
 
-    // close files
-    fclose(fileIn);
-    fclose(fileOut);
+    int result = 0;
+    for (;;) {
+        if (watchMode)
+            result = compileWatched(argv[1], fileIn, argv[2], &profile);
+        else
+            result = compileInput(argv[1], fileIn, argv[2], &profile);
+        fclose(fileIn);
+        fflush(stdout);
+        if (!watchMode)
+            break;
 
-    pool_xform_t *xform = get_pool_xform();
+        // the file is opened again, because editors often replace it
+        // instead of writing to it
+        printf("* watching %s\n", argv[1]);
+        fflush(stdout);
+        do {
+            if (!waitForChange(argv[1])) {
+                printf("ERROR: can't watch %s\n", argv[1]);
+                return -2;
+            }
+            fileIn = fopen(argv[1], "rb");
+        } while (fileIn == NULL);
+    }
+    return result;
+}
 
-    // print statistics
-    printf("* dmMultiplier: %f\n"
-           "* skMultiplier: %f\n"
-           "* dmDeltaX: %d\n"
-           "* dmDeltaY: %d\n"
-           "* skDeltaX: %d\n"
-           "* skDeltaY: %d\n"
-           "* generated pool size: %d\n"
-           "* total number of objects: %d\n"
-           "* number of root level objects: %d\n"
-           "***************************************************\n",
-           xform->dm_mult, xform->sk_mult,
-           xform->dm_dx, xform->dm_dy, xform->sk_dx, xform->sk_dy,
-           pool_size, nro_total_objects, nro_root_objects);
+//
+// returns the symbol table for the daemon as "<id> <name>" lines,
+// count is set to the number of lines. The text must be freed!
+//
+char *listNames(int *count, int *length)
+{
+    *count = 0;
+    int size = 0;
+    for (node_t *node = list_start; node != NULL; node = node->tail) {
+        size += strlen(node->name) + 16;
+        (*count)++;
+    }
+    char *names = (char *) malloc(size + 1);
+    *length = 0;
+    for (node_t *node = list_start; node != NULL; node = node->tail)
+        *length += sprintf(names + *length, "%d %s\n", node->id, node->name);
+    return names;
+}
 
-    return 0;
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strncmp("-daemon=", argv[1], 8) == 0)
+        return runDaemon(argc, argv, runParser, listNames);
+    if (argc >= 2 && strncmp("-batch=", argv[1], 7) == 0)
+        return runBatch(argc, argv, runParser);
+    for (int i = 3; i < argc; i++) {
+        if (strncmp("-connect=", argv[i], 9) == 0)
+            return runClient(argc, argv, argv[i] + 9);
+    }
+    return runParser(argc, argv);
 }
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#endif
+
+#include "daemon.h"
+#include "share.h"
+
+// look share.h for function definitions
+
+FILE *openSharedPool()
+{
+#ifdef __linux__
+    int fd = memfd_create("pooleditparser", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        printf("ERROR: can't create memory file: %s\n", strerror(errno));
+        return NULL;
+    }
+    FILE *file = fdopen(fd, "w+b");
+    if (file == NULL)
+        close(fd);
+    return file;
+#else
+    printf("ERROR: memory files are not supported on this platform\n");
+    return NULL;
+#endif
+}
+
+int sendSharedPool(FILE *file, pool_sink_t *indexSink, const char *socketPath)
+{
+#ifdef __linux__
+    SharedPoolMessage message;
+    message.magic = SHARED_POOL_MAGIC;
+    message.poolSize = ftell(file);
+    message.indexOffset = (message.poolSize + 7) & ~7u;
+
+    static const char padding[8] = { 0 };
+    int ok = fwrite(padding, 1, message.indexOffset - message.poolSize, file) ==
+        message.indexOffset - message.poolSize;
+    ok = write_index_sink(indexSink, file, message.poolSize) && ok;
+    ok = fflush(file) == 0 && ok;
+    message.size = ftell(file);
+
+    // after the seals nobody can change the pool, so the receiver
+    // doesn't have to copy it
+    int fd = fileno(file);
+    if (ok && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        printf("ERROR: can't seal memory file: %s\n", strerror(errno));
+        ok = false;
+    }
+
+    int client = ok ? connectDaemon(socketPath) : -1;
+    if (ok && client < 0) {
+        printf("ERROR: can't connect to %s\n", socketPath);
+        ok = false;
+    }
+    if (ok) {
+        struct iovec vector;
+        vector.iov_base = &message;
+        vector.iov_len = sizeof(message);
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        struct cmsghdr *descriptor = CMSG_FIRSTHDR(&header);
+        descriptor->cmsg_level = SOL_SOCKET;
+        descriptor->cmsg_type = SCM_RIGHTS;
+        descriptor->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(descriptor), &fd, sizeof(int));
+        if (sendmsg(client, &header, 0) != (ssize_t) sizeof(message)) {
+            printf("ERROR: can't send to %s: %s\n", socketPath, strerror(errno));
+            ok = false;
+        }
+    }
+    if (client >= 0)
+        close(client);
+    fclose(file);
+    return ok;
+#else
+    (void) socketPath;
+    write_index_sink(indexSink, file, 0);
+    fclose(file);
+    return false;
+#endif
+}
+
+int receiveSharedPool(int fd, SharedPoolMessage *message)
+{
+#ifdef __linux__
+    struct iovec vector;
+    vector.iov_base = message;
+    vector.iov_len = sizeof(*message);
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &header, MSG_CMSG_CLOEXEC) != (ssize_t) sizeof(*message))
+        return -1;
+    struct cmsghdr *descriptor = CMSG_FIRSTHDR(&header);
+    if (descriptor == NULL || descriptor->cmsg_type != SCM_RIGHTS ||
+        descriptor->cmsg_len != CMSG_LEN(sizeof(int)))
+        return -1;
+    int pool;
+    memcpy(&pool, CMSG_DATA(descriptor), sizeof(int));
+    if (message->magic != SHARED_POOL_MAGIC) {
+        close(pool);
+        return -1;
+    }
+    return pool;
+#else
+    (void) fd;
+    (void) message;
+    return -1;
+#endif
+}
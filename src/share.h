@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <stdio.h>
+
+#include "index.h"
+
+// Shared pool: the binary pool is written to an anonymous memory file
+// (memfd) instead of a file on disk, sealed so that it can't be changed
+// any more, and the descriptor is sent to another process over a UNIX
+// domain socket (SCM_RIGHTS). The receiver maps it read-only and can
+// pass the pool to the bus without copying it.
+//
+// The memory file has the pool at offset 0, followed by the index of
+// the pool (see index.h) at indexOffset, which is aligned to 8 bytes.
+// The descriptor is sent with one SharedPoolMessage. Only Linux has
+// memory files.
+
+#define SHARED_POOL_MAGIC 0x53504550  // "PEPS"
+
+#pragma pack(1)
+
+typedef struct
+{
+    unsigned int magic;
+    unsigned int poolSize;
+    unsigned int indexOffset;
+    unsigned int size;          // size of the memory file
+} SharedPoolMessage;
+
+#pragma pack()
+
+// creates the memory file, returns NULL if it can't be created
+FILE *openSharedPool();
+
+// appends the index of indexSink to the memory file, seals it and sends
+// it to the socket. Closes the file and frees the sink. Returns false
+// on error.
+int sendSharedPool(FILE *file, pool_sink_t *indexSink, const char *socketPath);
+
+// receives a shared pool from a connected socket, returns the
+// descriptor of the memory file or -1 on error
+int receiveSharedPool(int fd, SharedPoolMessage *message);
+
+#endif
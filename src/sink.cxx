@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "sink.h"
+
+// look sink.h for function definitions
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct
+{
+    pool_sink_t sink;     // must be first
+    FILE *file;
+    char *buffer;
+    int used;
+} FileSink;
+
+#ifdef _WIN32
+
+// writes the buffer and the spans, returns false on error
+int writeBatch(FileSink *f, const pool_span_t *spans, int count)
+{
+    if (f->used > 0 && fwrite(f->buffer, 1, f->used, f->file) != (size_t) f->used)
+        return false;
+    for (int i = 0; i < count; i++)
+        if (fwrite(spans[i].data, 1, spans[i].length, f->file) != (size_t) spans[i].length)
+            return false;
+    return true;
+}
+
+#else
+
+// writes all of the vectors, continuing after partial writes
+int writeVectors(int fd, struct iovec *vectors, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(fd, vectors, count < IOV_MAX ? count : IOV_MAX);
+        if (written < 0)
+            return false;
+        while (count > 0 && (size_t) written >= vectors->iov_len) {
+            written -= vectors->iov_len;
+            vectors++;
+            count--;
+        }
+        if (count > 0) {
+            vectors->iov_base = (char *) vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// writes the buffer and the spans, returns false on error
+int writeBatch(FileSink *f, const pool_span_t *spans, int count)
+{
+    struct iovec *vectors = (struct iovec *) malloc((count + 1) * sizeof(struct iovec));
+    int n = 0;
+    if (f->used > 0) {
+        vectors[n].iov_base = f->buffer;
+        vectors[n++].iov_len = f->used;
+    }
+    for (int i = 0; i < count; i++) {
+        vectors[n].iov_base = (void *) spans[i].data;
+        vectors[n++].iov_len = spans[i].length;
+    }
+    int ok = writeVectors(fileno(f->file), vectors, n);
+    free(vectors);
+    return ok;
+}
+
+#endif
+
+void fileSinkWrite(pool_sink_t *sink, const pool_span_t *spans, int count)
+{
+    FileSink *f = (FileSink *) sink;
+    int length = 0;
+    for (int i = 0; i < count; i++)
+        length += spans[i].length;
+
+    if (f->used + length <= SINK_BUFFER_SIZE) {
+        for (int i = 0; i < count; i++) {
+            memcpy(f->buffer + f->used, spans[i].data, spans[i].length);
+            f->used += spans[i].length;
+        }
+        return;
+    }
+
+    if (!writeBatch(f, spans, count)) {
+        printf("ERROR: can't write the pool!\n");
+        exit(-3);
+    }
+    f->used = 0;
+}
+
+pool_sink_t *open_file_sink(FILE *file)
+{
+    FileSink *f = (FileSink *) calloc(1, sizeof(FileSink));
+    f->buffer = (char *) malloc(SINK_BUFFER_SIZE);
+    if (f->buffer == NULL) {
+        printf("out of memory!\n");
+        exit(-1);
+    }
+    f->file = file;
+    f->sink.write = fileSinkWrite;
+    fflush(file);
+    return &f->sink;
+}
+
+void close_file_sink(pool_sink_t *sink)
+{
+    FileSink *f = (FileSink *) sink;
+    if (!writeBatch(f, NULL, 0)) {
+        printf("ERROR: can't write the pool!\n");
+        exit(-3);
+    }
+    free(f->buffer);
+    free(f);
+}
+
+typedef struct
+{
+    pool_sink_t sink;     // must be first
+    pool_image_t *image;
+    int capacity;
+    int directoryCapacity;
+} MemorySink;
+
+void memorySinkWrite(pool_sink_t *sink, const pool_span_t *spans, int count)
+{
+    MemorySink *m = (MemorySink *) sink;
+    pool_image_t *image = m->image;
+
+    int length = 0;
+    for (int i = 0; i < count; i++)
+        length += spans[i].length;
+    if (image->size + length > m->capacity) {
+        while (image->size + length > m->capacity)
+            m->capacity = m->capacity ? 2 * m->capacity : 64 * 1024;
+        image->data = (unsigned char *) realloc(image->data, m->capacity);
+    }
+    if (image->nro_entries + count > m->directoryCapacity) {
+        while (image->nro_entries + count > m->directoryCapacity)
+            m->directoryCapacity = m->directoryCapacity ? 2 * m->directoryCapacity : 256;
+        image->directory = (pool_entry_t *) realloc(image->directory,
+            m->directoryCapacity * sizeof(pool_entry_t));
+    }
+    if (image->data == NULL || image->directory == NULL) {
+        printf("out of memory!\n");
+        exit(-1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data = (const unsigned char *) spans[i].data;
+        pool_entry_t *entry = &image->directory[image->nro_entries++];
+        entry->object_id = data[0] | (data[1] << 8);
+        entry->type = data[2];
+        entry->offset = image->size;
+        entry->size = spans[i].length;
+        memcpy(image->data + image->size, data, spans[i].length);
+        image->size += spans[i].length;
+    }
+}
+
+pool_sink_t *open_memory_sink()
+{
+    MemorySink *m = (MemorySink *) calloc(1, sizeof(MemorySink));
+    m->image = (pool_image_t *) calloc(1, sizeof(pool_image_t));
+    m->sink.write = memorySinkWrite;
+    return &m->sink;
+}
+
+pool_image_t *close_memory_sink(pool_sink_t *sink)
+{
+    MemorySink *m = (MemorySink *) sink;
+    pool_image_t *image = m->image;
+
+    // give back the unused capacity
+    if (image->size > 0)
+        image->data = (unsigned char *) realloc(image->data, image->size);
+    if (image->nro_entries > 0)
+        image->directory = (pool_entry_t *) realloc(image->directory,
+            image->nro_entries * sizeof(pool_entry_t));
+    free(m);
+    return image;
+}
+
+void free_pool_image(pool_image_t *image)
+{
+    if (image == NULL)
+        return;
+    free(image->data);
+    free(image->directory);
+    free(image);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+
+#include "parser.h"
+
+// Output sink that writes the pool to a file. Objects are copied to a
+// large buffer, and when a batch doesn't fit in it the buffer and the
+// batch are written with one writev() call, so big pictures are not
+// copied at all.
+
+// buffer size of the file sink
+#define SINK_BUFFER_SIZE (1024 * 1024)
+
+// creates a sink that writes to file. Anything already written to file
+// with stdio is flushed first.
+pool_sink_t *open_file_sink(FILE *file);
+
+// writes the buffered data and frees the sink, file is not closed
+void close_file_sink(pool_sink_t *sink);
+
+// An object of a pool image: the object is at data + offset
+typedef struct pool_entry {
+    int object_id;
+    int type;
+    int offset;
+    int size;
+} pool_entry_t;
+
+// a pool in one exactly sized buffer, with a directory of the objects
+// in pool order
+typedef struct pool_image {
+    unsigned char *data;
+    int size;
+    pool_entry_t *directory;
+    int nro_entries;
+} pool_image_t;
+
+// creates a sink that builds a pool image in memory. Objects are
+// copied once to the image as they are written, and the directory is
+// filled at the same time.
+pool_sink_t *open_memory_sink();
+
+// frees the sink and returns the image, free it with free_pool_image()
+pool_image_t *close_memory_sink(pool_sink_t *sink);
+void free_pool_image(pool_image_t *image);
+
+#endif
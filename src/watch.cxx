@@ -0,0 +1,518 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "cache.h"
+#include "parser.h"
+#include "watch.h"
+#include "xml.h"
+
+// look watch.h for function definitions
+
+// returns the index after the construct starting at xml[i] that ends
+// with end, or length if it doesn't end
+static int skipPast(const char *xml, int length, int i, const char *end)
+{
+    int endLength = strlen(end);
+    for (; i + endLength <= length; i++)
+        if (memcmp(xml + i, end, endLength) == 0)
+            return i + endLength;
+    return length;
+}
+
+int splitRoots(const char *xml, int length, int *headerLength, RootSlice **slices)
+{
+    int count = 0;
+    int capacity = 0;
+    int depth = 0;
+    int sliceStart = 0;
+    *slices = NULL;
+    *headerLength = -1;
+
+    int i = 0;
+    while (i < length) {
+        if (xml[i] != '<') {
+            i++;
+            continue;
+        }
+        if (strncmp(xml + i, "<!--", 4) == 0) {
+            i = skipPast(xml, length, i + 4, "-->");
+            continue;
+        }
+        if (strncmp(xml + i, "<![CDATA[", 9) == 0) {
+            i = skipPast(xml, length, i + 9, "]]>");
+            continue;
+        }
+        if (strncmp(xml + i, "<?", 2) == 0) {
+            i = skipPast(xml, length, i + 2, "?>");
+            continue;
+        }
+        if (strncmp(xml + i, "<!", 2) == 0) {
+            i = skipPast(xml, length, i + 2, ">");
+            continue;
+        }
+
+        // start or end tag, the attribute values may contain '>'
+        int tagStart = i;
+        char quote = 0;
+        for (i++; i < length; i++) {
+            if (quote != 0) {
+                if (xml[i] == quote)
+                    quote = 0;
+            }
+            else if (xml[i] == '"' || xml[i] == '\'')
+                quote = xml[i];
+            else if (xml[i] == '>')
+                break;
+        }
+        if (i == length)
+            break;
+        i++;
+
+        if (xml[tagStart + 1] == '/') {
+            depth--;
+            if (depth == 0)
+                return count;
+            if (depth == 1) {
+                if (count == capacity) {
+                    capacity = capacity ? 2 * capacity : 256;
+                    *slices = (RootSlice *) realloc(*slices, capacity * sizeof(RootSlice));
+                }
+                (*slices)[count].start = sliceStart;
+                (*slices)[count].length = i - sliceStart;
+                count++;
+            }
+            continue;
+        }
+
+        int selfClosing = xml[i - 2] == '/';
+        if (depth == 0) {
+            *headerLength = i;
+            if (selfClosing)
+                return 0;
+        }
+        else if (depth == 1) {
+            sliceStart = tagStart;
+            if (selfClosing) {
+                if (count == capacity) {
+                    capacity = capacity ? 2 * capacity : 256;
+                    *slices = (RootSlice *) realloc(*slices, capacity * sizeof(RootSlice));
+                }
+                (*slices)[count].start = sliceStart;
+                (*slices)[count].length = i - sliceStart;
+                count++;
+            }
+        }
+        if (!selfClosing)
+            depth++;
+    }
+
+    // the objectpool element was not closed
+    free(*slices);
+    *slices = NULL;
+    return -1;
+}
+
+// the objects a root level element produced
+typedef struct
+{
+    unsigned long long key;
+    char *name;
+    int id;
+    unsigned char *data;
+    int size;
+    pool_entry_t *entries;  // offsets are relative to data
+    int nroEntries;
+    int use;                // the element or its children have "use"
+} RootResult;
+
+// results of the previous compile
+RootResult *rootResults = NULL;
+int nroRootResults = 0;
+
+// state of the parse of the changed elements
+RootResult *parsedRoots;
+const int *parsedOrder;
+int parsedCount;
+int nroParsed;
+int *parsedBounds;
+int parsedDepth;
+pool_sink_t *parsedSink;
+
+static void rootStart(void *data, char *el, const char **attr)
+{
+    (void) data;
+    (void) el;
+    if (nroParsed >= parsedCount) {
+        parsedDepth++;
+        return;
+    }
+    if (parsedDepth == 1) {
+        RootResult *result = &parsedRoots[parsedOrder[nroParsed]];
+        char *name = getName(attr);
+        result->name = strdup(name ? name : "");
+        result->id = getId(attr);
+    }
+    if (parsedDepth >= 1 && getAttribute(attr, "use") != NULL)
+        parsedRoots[parsedOrder[nroParsed]].use = true;
+    parsedDepth++;
+}
+
+static void rootEnd(void *data, char *el)
+{
+    (void) data;
+    (void) el;
+    parsedDepth--;
+    if (parsedDepth == 1 && nroParsed < parsedCount)
+        parsedBounds[nroParsed++] = parsedSink->objects;
+}
+
+static void freeResult(RootResult *result)
+{
+    free(result->name);
+    free(result->data);
+    free(result->entries);
+}
+
+// parses the elements order[0..count-1] of slices in one document with
+// the header of the original document. Returns false if the parser
+// didn't see the same elements.
+static int parseRoots(const char *xml, int headerLength, const RootSlice *slices,
+                      const int *order, int count, RootResult *results,
+                      int dimension, int skWidth, int skHeight, int colors)
+{
+    static const char footer[] = "</objectpool>";
+    int length = headerLength + (int) sizeof(footer) - 1;
+    for (int i = 0; i < count; i++)
+        length += slices[order[i]].length;
+    char *document = (char *) malloc(length);
+    memcpy(document, xml, headerLength);
+    int used = headerLength;
+    for (int i = 0; i < count; i++) {
+        memcpy(document + used, xml + slices[order[i]].start, slices[order[i]].length);
+        used += slices[order[i]].length;
+    }
+    memcpy(document + used, footer, sizeof(footer) - 1);
+
+    FILE *file = fmemopen(document, length, "rb");
+    if (file == NULL) {
+        free(document);
+        return false;
+    }
+    parsedRoots = results;
+    parsedOrder = order;
+    parsedCount = count;
+    nroParsed = 0;
+    parsedDepth = 0;
+    parsedBounds = (int *) malloc((count + 1) * sizeof(int));
+    parsedSink = open_memory_sink();
+    set_output_sink(parsedSink);
+    parse(file, rootStart, rootEnd, NULL, dimension, skWidth, skHeight, colors);
+    set_output_sink(NULL);
+    pool_image_t *image = close_memory_sink(parsedSink);
+    fclose(file);
+    free(document);
+
+    int ok = nroParsed == count;
+    for (int i = 0; ok && i < count; i++) {
+        RootResult *result = &results[order[i]];
+        int first = i ? parsedBounds[i - 1] : 0;
+        int last = parsedBounds[i];
+        int base = (last > first) ? image->directory[first].offset : 0;
+        result->nroEntries = last - first;
+        result->entries = (pool_entry_t *) malloc((result->nroEntries + 1) * sizeof(pool_entry_t));
+        result->size = 0;
+        for (int j = 0; j < result->nroEntries; j++) {
+            result->entries[j] = image->directory[first + j];
+            result->entries[j].offset -= base;
+            result->size += result->entries[j].size;
+        }
+        result->data = (unsigned char *) malloc(result->size + 1);
+        memcpy(result->data, image->data + base, result->size);
+    }
+    free(parsedBounds);
+    free_pool_image(image);
+    return ok;
+}
+
+pool_image_t *compileRoots(FILE *file, int dimension, int skWidth, int skHeight, int colors,
+                           void (*root)(char *name, int id), WatchStats *stats)
+{
+#ifdef _WIN32
+    (void) file;
+    (void) dimension;
+    (void) skWidth;
+    (void) skHeight;
+    (void) colors;
+    (void) root;
+    (void) stats;
+    return NULL;
+#else
+    // the whole document
+    int length = 0;
+    int capacity = 64 * 1024;
+    char *xml = (char *) malloc(capacity + 1);
+    int n;
+    while ((n = fread(xml + length, 1, capacity - length, file)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            xml = (char *) realloc(xml, capacity + 1);
+        }
+    }
+    xml[length] = '\0';
+    rewind(file);
+
+    int headerLength;
+    RootSlice *slices;
+    int count = splitRoots(xml, length, &headerLength, &slices);
+    if (count < 0) {
+        free(slices);
+        free(xml);
+        return NULL;
+    }
+
+    // the header has the VT independent dimensions, so it is a part of
+    // every key
+    unsigned long long headerKey = hashBytes(xml, headerLength, HASH_SEED);
+    headerKey = hashInt(dimension, headerKey);
+    headerKey = hashInt(skWidth, headerKey);
+    headerKey = hashInt(skHeight, headerKey);
+    headerKey = hashInt(colors, headerKey);
+
+    // previous results are looked up in a hash table of their indexes
+    int tableSize = 16;
+    while (tableSize < 2 * nroRootResults)
+        tableSize *= 2;
+    int *table = (int *) malloc(tableSize * sizeof(int));
+    for (int i = 0; i < tableSize; i++)
+        table[i] = -1;
+    for (int i = 0; i < nroRootResults; i++) {
+        int slot = rootResults[i].key & (tableSize - 1);
+        while (table[slot] >= 0)
+            slot = (slot + 1) & (tableSize - 1);
+        table[slot] = i;
+    }
+
+    RootResult *results = (RootResult *) calloc(count + 1, sizeof(RootResult));
+    int *missing = (int *) malloc((count + 1) * sizeof(int));
+    int nroMissing = 0;
+    int use = false;
+    for (int i = 0; i < count; i++) {
+        unsigned long long key = hashBytes(xml + slices[i].start, slices[i].length, headerKey);
+        results[i].key = key;
+        int slot = key & (tableSize - 1);
+        for (; table[slot] >= 0; slot = (slot + 1) & (tableSize - 1)) {
+            RootResult *previous = &rootResults[table[slot]];
+            if (previous->key == key && previous->entries != NULL) {
+                results[i] = *previous;
+                previous->name = NULL;
+                previous->data = NULL;
+                previous->entries = NULL;
+                break;
+            }
+        }
+        if (results[i].entries == NULL)
+            missing[nroMissing++] = i;
+        else if (results[i].use)
+            use = true;
+    }
+    free(table);
+
+    // an element that was known to have "use" is not parsed again. The
+    // header is parsed even if nothing changed, it sets the scaling.
+    int ok = use ||
+        parseRoots(xml, headerLength, slices, missing, nroMissing, results,
+                   dimension, skWidth, skHeight, colors);
+    for (int i = 0; i < count; i++)
+        use = use || results[i].use;
+
+    for (int i = 0; i < nroRootResults; i++)
+        freeResult(&rootResults[i]);
+    free(rootResults);
+    rootResults = NULL;
+    nroRootResults = 0;
+    free(missing);
+    free(slices);
+    free(xml);
+
+    // with "use" the objects after the element may be scaled wrong, so
+    // only the elements that have it are kept to find it without
+    // parsing next time
+    if (!ok || use) {
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (ok && results[i].use)
+                results[kept++] = results[i];
+            else
+                freeResult(&results[i]);
+        }
+        if (kept > 0) {
+            rootResults = results;
+            nroRootResults = kept;
+        }
+        else
+            free(results);
+        return NULL;
+    }
+
+    rootResults = results;
+    nroRootResults = count;
+
+    // the pool is the results in document order
+    pool_image_t *image = (pool_image_t *) calloc(1, sizeof(pool_image_t));
+    int nroEntries = 0;
+    for (int i = 0; i < count; i++) {
+        image->size += results[i].size;
+        nroEntries += results[i].nroEntries;
+    }
+    image->data = (unsigned char *) malloc(image->size + 1);
+    image->directory = (pool_entry_t *) malloc((nroEntries + 1) * sizeof(pool_entry_t));
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(image->data + offset, results[i].data, results[i].size);
+        for (int j = 0; j < results[i].nroEntries; j++) {
+            pool_entry_t *entry = &image->directory[image->nro_entries++];
+            *entry = results[i].entries[j];
+            entry->offset += offset;
+        }
+        offset += results[i].size;
+        root(results[i].name, results[i].id);
+    }
+
+    stats->roots = count;
+    stats->compiled = nroMissing;
+    return image;
+#endif
+}
+
+void writeRoots(FILE *file)
+{
+    fwrite(&nroRootResults, sizeof(int), 1, file);
+    for (int i = 0; i < nroRootResults; i++) {
+        RootResult *result = &rootResults[i];
+        int nameLength = strlen(result->name);
+        fwrite(result, sizeof(RootResult), 1, file);
+        fwrite(&nameLength, sizeof(int), 1, file);
+        fwrite(result->name, 1, nameLength, file);
+        fwrite(result->data, 1, result->size, file);
+        fwrite(result->entries, sizeof(pool_entry_t), result->nroEntries, file);
+    }
+}
+
+int readRoots(FILE *file)
+{
+    int count;
+    if (fread(&count, sizeof(int), 1, file) != 1 || count < 0)
+        return false;
+
+    // the pointers of the written structures are not used
+    RootResult *results = (RootResult *) calloc(count + 1, sizeof(RootResult));
+    int nroRead = 0;
+    for (; nroRead < count; nroRead++) {
+        RootResult *result = &results[nroRead];
+        int nameLength;
+        if (fread(result, sizeof(RootResult), 1, file) != 1 ||
+            fread(&nameLength, sizeof(int), 1, file) != 1 || nameLength < 0 ||
+            result->size < 0 || result->nroEntries < 0) {
+            memset(result, 0, sizeof(RootResult));
+            break;
+        }
+        result->name = (char *) malloc(nameLength + 1);
+        result->data = (unsigned char *) malloc(result->size + 1);
+        result->entries = (pool_entry_t *) malloc((result->nroEntries + 1) * sizeof(pool_entry_t));
+        result->name[nameLength] = '\0';
+        if (fread(result->name, 1, nameLength, file) != (size_t) nameLength ||
+            fread(result->data, 1, result->size, file) != (size_t) result->size ||
+            fread(result->entries, sizeof(pool_entry_t), result->nroEntries, file) !=
+            (size_t) result->nroEntries) {
+            freeResult(result);
+            break;
+        }
+    }
+    if (nroRead < count) {
+        for (int i = 0; i < nroRead; i++)
+            freeResult(&results[i]);
+        free(results);
+        return false;
+    }
+
+    for (int i = 0; i < nroRootResults; i++)
+        freeResult(&rootResults[i]);
+    free(rootResults);
+    rootResults = results;
+    nroRootResults = count;
+    return true;
+}
+
+int waitForChange(const char *fileName)
+{
+#ifdef __linux__
+    // the directory is watched, because the file may be replaced
+    static int fd = -1;
+    const char *slash = strrchr(fileName, '/');
+    const char *base = slash ? slash + 1 : fileName;
+    if (fd < 0) {
+        char dir[1024];
+        if (slash != NULL)
+            snprintf(dir, sizeof(dir), "%.*s", (int) (slash - fileName), fileName);
+        else
+            snprintf(dir, sizeof(dir), ".");
+        fd = inotify_init();
+        if (fd < 0)
+            return false;
+        if (inotify_add_watch(fd, dir[0] ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    union
+    {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+    for (;;) {
+        int length = read(fd, buffer.bytes, sizeof(buffer.bytes));
+        if (length <= 0)
+            return false;
+        for (int i = 0; i < length; ) {
+            struct inotify_event *event = (struct inotify_event *) (buffer.bytes + i);
+            if (event->len > 0 && strcmp(event->name, base) == 0)
+                return true;
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#else
+    (void) fileName;
+    return false;
+#endif
+}
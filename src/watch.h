@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2007-2019 Automation technology laboratory,
+ * Helsinki University of Technology
+ *
+ * Visit automation.tkk.fi for information about the automation
+ * technology laboratory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdio.h>
+
+#include "sink.h"
+
+// Incremental compilation for watch mode. The XML document is split
+// into the root level objects (the elements directly inside
+// objectpool), and the objects each of them produced in the last
+// compile are kept in memory by the hash of its XML text. Only the
+// root level objects whose text changed are parsed again, in one
+// document that has the original header, and the pool is put together
+// from the results in document order.
+//
+// The "use" attribute changes the multiplier of the following
+// elements too, so if the document has one everything is parsed
+// again. The pool passes that need the whole pool (-dedup, -prune,
+// -macros, -renumber, -max-size) can't be used either.
+
+// a root level element: the offset and length of its text
+typedef struct
+{
+    int start;
+    int length;
+} RootSlice;
+
+// finds the root level elements of a document. headerLength is set to
+// the length of the text up to and including the objectpool start
+// tag. Returns the number of elements (slices is malloc'ed), or -1 if
+// the document has no objectpool element.
+int splitRoots(const char *xml, int length, int *headerLength, RootSlice **slices);
+
+// counts of the last compileRoots()
+typedef struct
+{
+    int roots;
+    int compiled;
+} WatchStats;
+
+// compiles the XML file with the results of the previous call. root()
+// is called with the name and id of every root level object in order.
+// Returns the pool image (free it with free_pool_image()), or NULL if
+// the document can't be compiled incrementally.
+pool_image_t *compileRoots(FILE *file, int dimension, int skWidth, int skHeight, int colors,
+                           void (*root)(char *name, int id), WatchStats *stats);
+
+// writes the results of the last compileRoots() to a file, and reads
+// them back in another process. readRoots() keeps the results it has
+// and returns false if the file ends before all of them are read.
+void writeRoots(FILE *file);
+int readRoots(FILE *file);
+
+// waits until the file has been written or replaced, returns false if
+// that can't be watched
+int waitForChange(const char *fileName);
+
+#endif
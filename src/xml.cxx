@@ -23,6 +23,10 @@
 
 #include "xml.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // look xml.h for function definitions
 
 int atoi2(char *str)
@@ -56,72 +60,101 @@ char *getAttribute(const char **attrs, const char *name)
 
 ////////// utf-8 to latin-1 conversion functions //////////
 
-char *str_dup(const char *p)
+// returns the number of leading bytes that are plain ASCII
+static size_t asciiPrefix(const unsigned char *src, size_t length)
 {
-    size_t len = strlen(p);
-    char *rv = (char *) malloc(len + 1);
-    if (rv == NULL) {
-        fprintf(stderr, "malloc failed!\n");
-        exit(1);
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        int mask = _mm_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
     }
-    strcpy(rv, p);
-    return rv;
-}
-
-size_t get_length(unsigned char c)
-{
-    if (c < 0x80) return 1;
-    else if (!(c & 0x20)) return 2;
-    else if (!(c & 0x10)) return 3;
-    else if (!(c & 0x08)) return 4;
-    else if (!(c & 0x04)) return 5;
-    else return 6;
-}
-
-int utf8toLatin1Char(char **p)
-{
-    size_t len = get_length(**p);
-    if (len == 1)
-        return **p;
-
-    int res = (**p & (0xFF >> (len + 1))) << ((len - 1) * 6);
-
-    for (--len; len; --len) {
-        ++(*p);
-        res |= ((**p) - 0x80) << ((len - 1) * 6);
+#else
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long v;
+        memcpy(&v, src + i, 8);
+        if (v & 0x8080808080808080ULL)
+            break;
     }
-    return res;
-}
+#endif
+    while (i < length && src[i] < 0x80)
+        i++;
+    return i;
+}
+
+// returns the length of a valid UTF-8 sequence starting at src, or 0
+// if the sequence is invalid (bad lead or continuation byte, overlong
+// form, surrogate or a code point above U+10FFFF)
+static int utf8SequenceLength(const unsigned char *src, size_t length)
+{
+    unsigned char c = src[0];
+    int len;
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if (c >= 0xC2 && c <= 0xDF)
+        len = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;
+        if (c == 0xED) hi = 0x9F;
+    }
+    else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;
+        if (c == 0xF4) hi = 0x8F;
+    }
+    else
+        return 0;
 
-// in-place conversion
-char *utf8toLatin1Str(char *rv)
-{
-    int i = 0;
-    for (char *p = rv; *p; ++p, ++i) {
-        int value = utf8toLatin1Char(&p);
-        if (value > 0xFF) {
-            fprintf(stderr, "utf8toLatin1Char() failed!\n");
-            exit(1);
+    if ((size_t) len > length || src[1] < lo || src[1] > hi)
+        return 0;
+    for (int i = 2; i < len; i++)
+        if (src[i] < 0x80 || src[i] > 0xBF)
+            return 0;
+    return len;
+}
+
+int copyAttributeLatin1(const char **attrs, const char *name, unsigned char *dest, int length)
+{
+    const unsigned char *src = (const unsigned char *) getAttribute(attrs, name);
+    size_t srcLength = src ? strlen((const char *) src) : 0;
+    size_t s = 0;
+    int d = 0;
+    int replaced = 0;
+
+    while (d < length && s < srcLength) {
+        // copy runs of ASCII as such
+        size_t run = asciiPrefix(src + s, srcLength - s);
+        if (run > (size_t) (length - d))
+            run = length - d;
+        memcpy(dest + d, src + s, run);
+        d += run;
+        s += run;
+        if (d == length || s == srcLength)
+            break;
+
+        int len = utf8SequenceLength(src + s, srcLength - s);
+        if (len == 2 && src[s] <= 0xC3) {
+            dest[d++] = ((src[s] & 0x1F) << 6) | (src[s + 1] & 0x3F);
         }
-        rv[i] = value;
+        else {
+            // valid character outside of Latin-1, or invalid byte
+            dest[d++] = '?';
+            replaced++;
+        }
+        s += len ? len : 1;
     }
-    rv[i] = '\0';
-    return rv;
-}
+    memset(dest + d, ' ', length - d);
 
-// user must free the returned pointer!
-char *getAttributeLatin1(const char **attrs, const char *name)
-{
-    char *value = getAttribute(attrs, name);
-    if (value == NULL)
-        return NULL;
-    char *rv = str_dup(value);
-    return utf8toLatin1Str(rv);
+    if (replaced)
+        printf("WARNING: %d character(s) of %s=\"%s\" replaced with '?', "
+               "not in Latin-1\n", replaced, name, (const char *) src);
+    return replaced;
 }
 
 
-/////////////////
-
 char *getAttributeError(const char **attrs, const char *name)
 {
     char *retval = getAttribute(attrs, name);
@@ -583,40 +616,14 @@ int getValidationType(const char **attrs) {
     return 0;
 }
 
-// returns the value-attribute as string, that is given length.
-// given string must be freed!
-char *getValueString(const char **attrs, int length)
+int copyValueString(const char **attrs, unsigned char *dest, int length)
 {
-    char *string = (char *) malloc(sizeof(char) * length);
-    char *value = getAttributeLatin1(attrs, "value");
-    int valueLength = strlen(value);
-
-    if (length <= valueLength) {
-        memcpy(string, value, length);
-    }
-    else {
-        memcpy(string, value, valueLength);
-        memset(string + valueLength, ' ', length - valueLength);
-    }
-    free(value);
-    return string;
+    return copyAttributeLatin1(attrs, "value", dest, length);
 }
 
-char *getValidatioinString(const char **attrs, int length)
+int copyValidationString(const char **attrs, unsigned char *dest, int length)
 {
-    char *string = (char *) malloc(sizeof(char) * length);
-    char *value = getAttributeLatin1(attrs, "validation_string");
-    int valueLength = strlen(value);
-
-    if (length <= valueLength) {
-        memcpy(string, value, length);
-    }
-    else {
-        memcpy(string, value, valueLength);
-        memset(string + valueLength, ' ', length - valueLength);
-    }
-    free(value);
-    return string;
+    return copyAttributeLatin1(attrs, "validation_string", dest, length);
 }
 
 int getOptions(const char **attrs, const char **names, int bits, const char *name)
@@ -922,6 +929,14 @@ int getListIndex(const char **attrs)
     return atoi2(getAttribute(attrs, "list_index"));
 }
 
+char *getLanguageCode(const char **attrs)
+{
+    char *code = getAttribute(attrs, "code");
+    if (code == NULL || strlen(code) < 2)
+        return NULL;
+    return code;
+}
+
 float getMultiplier(const char **attrs, float old, float mask, float designator)
 {
     float multip = old;
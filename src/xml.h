@@ -129,10 +129,15 @@ int getPolygonType(const char **attrs);
 int getFunctionType(const char **attrs);
 int getFunctionAttributes(const char **attrs);
 
-// returns the value-attribute as string, that is given length given
-// string must be freed!
-char *getValueString(const char **attrs, int length);
-char *getValidatioinString(const char **attrs, int length);
+// copies the attribute converted from UTF-8 to Latin-1 into dest,
+// truncated or padded with spaces to given length. Characters that
+// are not in Latin-1 and invalid UTF-8 are replaced with '?'. Returns
+// the number of replaced characters.
+int copyAttributeLatin1(const char **attrs, const char *name, unsigned char *dest, int length);
+
+// copies the value-attribute (or validation_string) as above
+int copyValueString(const char **attrs, unsigned char *dest, int length);
+int copyValidationString(const char **attrs, unsigned char *dest, int length);
 
 int getInputStringOptions(const char **attrs);
 int getInputNumberOptions(const char **attrs);
@@ -171,6 +176,10 @@ int getPosX(const char **attrs);
 int getPosY(const char **attrs);
 int getListIndex(const char **attrs);
 
+// returns the two letter code of a language element, or NULL if the
+// code is missing or too short
+char *getLanguageCode(const char **attrs);
+
 // for getting multipliers
 float getMultiplier(const char **attrs, float old, float mask, float designator);
 